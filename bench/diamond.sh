@@ -0,0 +1,32 @@
+#!/bin/sh
+# Run of mmake on a chain of diamonds that is up to date.  Each layer has two
+# targets which both depend on both targets of the next layer, so there are
+# 2^LAYERS paths from the top, but each target is visited only once and the
+# time should grow linearly with the number of layers.
+. "$(dirname "$0")/lib.sh"
+
+T=1700000000
+
+for layers in 16 20 1000; do
+	awk -v n=$layers 'BEGIN {
+		print "all: a0 b0\n\ttouch all"
+		for (i = 0; i < n; i++) {
+			deps = i + 1 < n ? " a" i + 1 " b" i + 1 : ""
+			print "a" i ":" deps "\n\ttouch a" i
+			print "b" i ":" deps "\n\ttouch b" i
+		}
+	}' > mmakefile
+
+	# every layer is newer than the one below it
+	i=$layers
+	while [ $i -gt 0 ]; do
+		i=$((i - 1))
+		touch -d @$((T + layers - i)) a$i b$i
+	done
+	touch -d @$((T + layers + 1)) all
+
+	printf '%5d layers: ' $layers
+	elapsed "$MMAKE"
+	[ -n "$(find . -newer all -name '[ab]*')" ] && echo "$NAME: targets were rebuilt" >&2
+	rm -f .mmakefile.mmake.cache .mmake_log
+done
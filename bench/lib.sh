@@ -0,0 +1,38 @@
+# Shared setup of the benchmarks, sourced by each of them.  A benchmark runs
+# in a directory of its own, which is removed when it exits.  The programs it
+# runs are built by `make bench`.
+
+MMAKE=$(cd "$(dirname "$0")/.." && pwd)/mmake
+BENCH=$(cd "$(dirname "$0")" && pwd)
+NAME=$(basename "$0" .sh)
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+echo "== $NAME"
+
+# gen_rules RULES PREREQS FILE
+# Write a makefile of RULES rules t<i>.o, each depending on PREREQS sources
+# and a shared header.
+gen_rules()
+{
+	awk -v n="$1" -v k="$2" 'BEGIN {
+		for (i = 0; i < n; i++) {
+			line = "t" i ".o:"
+			for (j = 0; j < k; j++)
+				line = line " src/t" (i + j) % n ".c"
+			print line " inc/common.h"
+			print "\ttouch t" i ".o"
+		}
+	}' > "$3"
+}
+
+# Print the wall time of a command in seconds
+elapsed()
+{
+	start=$(date +%s%N)
+	"$@" > /dev/null || echo "$NAME: $* exited with $?" >&2
+	end=$(date +%s%N)
+	awk -v ns=$((end - start)) 'BEGIN { printf "%.3f s\n", ns / 1e9 }'
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Parse of a rule with 100k prerequisites and a command with 100k arguments,
+# like a link step.  Each of the two lines is close to 2 MB.
+. "$(dirname "$0")/lib.sh"
+
+awk 'BEGIN {
+	printf "app:"
+	for (i = 0; i < 100000; i++)
+		printf " obj/file%d.o", i
+	printf "\n\tcc -o app"
+	for (i = 0; i < 100000; i++)
+		printf " obj/file%d.o", i
+	printf "\n"
+}' > long.mk
+
+"$BENCH/parse" long.mk
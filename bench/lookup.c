@@ -0,0 +1,55 @@
+/**
+ * Time rule lookups by name in a parsed makefile, to show that the cost of a
+ * lookup does not grow with the number of rules.
+ *
+ * Usage: lookup MAKEFILE RULES
+ *
+ * The makefile must have rules t0.o up to t<RULES-1>.o, as written by
+ * gen_rules in lib.sh.
+ *
+ * @file lookup.c
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "parser.h"
+
+#define LOOKUPS 1000000
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s MAKEFILE RULES\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	makefile *m = parse_makefile_path(argv[1]);
+	long n = atol(argv[2]);
+	if (m == NULL || n <= 0) {
+		fprintf(stderr, "%s: could not parse %s\n", argv[0], argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	// the names are made up front, so only the lookups are timed
+	char (*names)[32] = malloc(LOOKUPS * sizeof *names);
+	if (names == NULL)
+		return EXIT_FAILURE;
+	for (long i = 0; i < LOOKUPS; i++)
+		snprintf(names[i], sizeof names[i], "t%ld.o",
+				(long)((i * 2654435761u) % n));
+
+	struct timespec start, end;
+	long found = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < LOOKUPS; i++)
+		found += makefile_rule(m, names[i]) != NULL;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double ns = (end.tv_sec - start.tv_sec) * 1e9
+		+ (end.tv_nsec - start.tv_nsec);
+	printf("%8ld rules: %6.1f ns/lookup (%ld of %d found)\n", n,
+			ns / LOOKUPS, found, LOOKUPS);
+
+	free(names);
+	return found == LOOKUPS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,9 @@
+#!/bin/sh
+# Cost of looking up a rule by name, from 100 to 1M rules.  It should stay
+# about flat, growing only with cache misses as the tables get larger.
+. "$(dirname "$0")/lib.sh"
+
+for n in 100 10000 100000 1000000; do
+	gen_rules $n 2 rules.mk
+	"$BENCH/lookup" rules.mk $n
+done
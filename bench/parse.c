@@ -0,0 +1,45 @@
+/**
+ * Time the parse of a makefile, and count the prerequisites and arguments of
+ * its default rule to show that none were lost.
+ *
+ * Usage: parse MAKEFILE
+ *
+ * @file parse.c
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "parser.h"
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s MAKEFILE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	makefile *m = parse_makefile_path(argv[1]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (m == NULL) {
+		fprintf(stderr, "%s: could not parse %s\n", argv[0], argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	rule *r = makefile_rule(m, makefile_default_target(m));
+	size_t n_prereq = 0, n_cmd = 0;
+	for (const char **p = rule_prereq(r); *p != NULL; p++)
+		n_prereq++;
+	for (char **p = rule_cmd(r); *p != NULL; p++)
+		n_cmd++;
+
+	double ms = (end.tv_sec - start.tv_sec) * 1e3
+		+ (end.tv_nsec - start.tv_nsec) / 1e6;
+	printf("%s: %.1f ms, %zu nodes, default rule has %zu prerequisites "
+			"and %zu arguments\n", argv[1], ms, makefile_nodes(m),
+			n_prereq, n_cmd);
+
+	makefile_del(m);
+	return EXIT_SUCCESS;
+}
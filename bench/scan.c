@@ -0,0 +1,57 @@
+/**
+ * Measure how fast the tokenizer scans a long prerequisite line, in bytes per
+ * second.  The scanners are internal to the parser, so its source is included
+ * here.  Built once for each of the scanners: AVX2, SSE2 and scalar.
+ *
+ * Usage: scan
+ *
+ * @file scan.c
+ */
+#include "parser.c"
+#include <time.h>
+
+#define LINE_SIZE (16 * 1024 * 1024)
+#define REPEATS 20
+
+#if defined(__AVX2__)
+#define SCANNER "AVX2"
+#elif defined(__SSE2__)
+#define SCANNER "SSE2"
+#else
+#define SCANNER "scalar"
+#endif
+
+int main(void)
+{
+	// the text must be NUL-terminated and aligned like a parsed makefile
+	char *line = aligned_alloc(64, LINE_SIZE + 64);
+	if (line == NULL)
+		return EXIT_FAILURE;
+
+	size_t n = 0;
+	for (int i = 0; n < LINE_SIZE - 64; i++)
+		n += sprintf(line + n, "build/obj/some/dir/file_%d.o ", i);
+	line[n++] = '\n';
+	line[n] = '\0';
+
+	struct timespec start, end;
+	size_t words = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r = 0; r < REPEATS; r++) {
+		char *p = line;
+		skipwhite(&p);
+		while (parse_word(&p, '\0').n != 0) {
+			words++;
+			skipwhite(&p);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double s = (end.tv_sec - start.tv_sec)
+		+ (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%-6s %6.0f MB/s (%zu words in a %zu byte line)\n", SCANNER,
+			(double)n * REPEATS / s / 1e6, words / REPEATS, n);
+
+	free(line);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,10 @@
+#!/bin/sh
+# Speed of the tokenizer on a 16 MB prerequisite line, with the vector
+# scanners and with the scalar fallback.
+. "$(dirname "$0")/lib.sh"
+
+"$BENCH/scan_scalar"
+[ -x "$BENCH/scan_sse2" ] && "$BENCH/scan_sse2"
+if [ -x "$BENCH/scan_avx2" ] && grep -qw avx2 /proc/cpuinfo 2>/dev/null; then
+	"$BENCH/scan_avx2"
+fi
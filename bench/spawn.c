@@ -0,0 +1,68 @@
+/**
+ * Time starting trivial commands from a process holding a lot of memory,
+ * like mmake holding a large graph, with fork() and execvp() and with
+ * posix_spawnp().  fork() copies the page tables of all of that memory for
+ * every command, posix_spawnp() does not.
+ *
+ * Usage: spawn MEGABYTES COMMANDS fork|spawn
+ *
+ * @file spawn.c
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+int main(int argc, char *argv[])
+{
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s MEGABYTES COMMANDS fork|spawn\n",
+				argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	size_t size = (size_t)atol(argv[1]) << 20;
+	long n = atol(argv[2]);
+	bool spawn = strcmp(argv[3], "spawn") == 0;
+
+	// the memory is written so that it is resident
+	char *mem = malloc(size);
+	if (mem == NULL) {
+		perror(argv[0]);
+		return EXIT_FAILURE;
+	}
+	memset(mem, 1, size);
+
+	char *cmd[] = { "true", NULL };
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < n; i++) {
+		pid_t pid;
+		int status;
+		if (spawn) {
+			if (posix_spawnp(&pid, cmd[0], NULL, NULL, cmd, environ) != 0)
+				return EXIT_FAILURE;
+		} else if ((pid = fork()) == 0) {
+			execvp(cmd[0], cmd);
+			_exit(127);
+		} else if (pid < 0) {
+			return EXIT_FAILURE;
+		}
+		waitpid(pid, &status, 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double ms = (end.tv_sec - start.tv_sec) * 1e3
+		+ (end.tv_nsec - start.tv_nsec) / 1e6;
+	printf("%5s MB resident, %-5s %6.2f ms per command\n", argv[1], argv[3],
+			ms / n);
+
+	free(mem);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,11 @@
+#!/bin/sh
+# Cost of starting a trivial command with fork() and with posix_spawnp(), from
+# a small process and from one holding 1 GB.  Set COMMANDS to start fewer
+# than 10000 commands; with fork() from 1 GB they take minutes.
+. "$(dirname "$0")/lib.sh"
+
+for mb in 16 1024; do
+	for how in fork spawn; do
+		"$BENCH/spawn" $mb "${COMMANDS:-10000}" $how
+	done
+done
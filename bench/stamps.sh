@@ -0,0 +1,25 @@
+#!/bin/sh
+# Run of a makefile of stamp rules, each of which touches its target, with
+# the commands run as builtins and as programs: first with all stamps
+# missing, then with all of them existing and -B.  Set STAMPS to use fewer
+# than 100000 rules; as programs they take about a minute.
+. "$(dirname "$0")/lib.sh"
+
+n=${STAMPS:-100000}
+awk -v n=$n 'BEGIN {
+	printf "all:"
+	for (i = 0; i < n; i++)
+		printf " stamp%d", i
+	printf "\n\ttouch all\n"
+	for (i = 0; i < n; i++)
+		printf "\nstamp%d: src\n\ttouch stamp%d\n", i, i
+}' > mmakefile
+touch src
+
+for opt in "" --no-builtins; do
+	rm -f all stamp*
+	printf '%-13s %6d stamps missing:   ' "${opt:-builtins}" $n
+	elapsed "$MMAKE" -s $opt
+	printf '%-13s %6d stamps exist, -B: ' "${opt:-builtins}" $n
+	elapsed "$MMAKE" -s -B $opt
+done
@@ -0,0 +1,404 @@
+/**
+ * Log of the targets built by earlier runs.
+ *
+ * @file buildlog.c
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "buildlog.h"
+#include "util.h"
+
+#define LOG_MAGIC "mmlog\0\0\2"
+#define HASH_BUF (64 * 1024)
+#define LOG_COMPACT_MIN 1024
+#define LOG_COMPACT_RATIO 3
+#define OTHERS_MIN 64
+
+/**
+ * Layout of a log file.  The header is followed by records, each starting on
+ * an 8 byte boundary.  A record written only in part, because mmake was
+ * interrupted, ends the log and is cut off when the log is opened.
+ */
+struct log_header {
+	char magic[8];
+	uint64_t byte_order;
+};
+
+struct log_record {
+	struct log_entry entry;
+	uint32_t name_len;	// not counting the terminating NUL
+	uint32_t size;		// of the whole record, including padding
+	char name[];
+};
+
+struct build_log {
+	makefile *make;
+	char *path;
+	int fd;			// opened for appending
+	void *map;
+	size_t map_size;
+	const struct log_entry **entries;	// latest record by node
+	struct log_entry *fresh;	// records made by this run, by node
+	const struct log_record **others;	// latest of names not in make
+	size_t others_mask;	// number of slots in others minus one
+	size_t n_others;
+	bool others_lost;	// not all of them fit, so do not compact
+	size_t n_records;
+	size_t n_live;		// targets with a record
+};
+
+/**
+ * Write a header to an empty log.
+ */
+static bool write_header(int fd)
+{
+	struct log_header h = { .byte_order = 0x0102030405060708 };
+	memcpy(h.magic, LOG_MAGIC, sizeof h.magic);
+
+	return write(fd, &h, sizeof h) == sizeof h;
+}
+
+/**
+ * Write a record for the target with the given name to fd in a single write,
+ * so that records appended by different runs are never interleaved.
+ */
+static bool write_record(int fd, const char *name, const struct log_entry *e)
+{
+	size_t len = strlen(name);
+	size_t size = ALIGN8(sizeof(struct log_record) + len + 1);
+
+	struct log_record *r = calloc(1, size);
+	if (r == NULL)
+		return false;
+	r->entry = *e;
+	r->name_len = len;
+	r->size = size;
+	memcpy(r->name, name, len + 1);
+
+	bool ok = write(fd, r, size) == (ssize_t)size;
+	free(r);
+	return ok;
+}
+
+/**
+ * Keep r as the latest record of a name that is not in the makefile, so that
+ * compaction keeps it for the makefile it belongs to.  The table is open
+ * addressing with linear probing, and is kept at most half full.
+ *
+ * @return      false if memory could not be allocated.
+ */
+static bool add_other(build_log *l, const struct log_record *r)
+{
+	if (2 * (l->n_others + 1) > l->others_mask + 1) {
+		size_t cap = l->others == NULL ? OTHERS_MIN
+			: 2 * (l->others_mask + 1);
+		const struct log_record **t = calloc(cap, sizeof *t);
+		if (t == NULL)
+			return false;
+		for (size_t i = 0; l->others != NULL && i <= l->others_mask; i++) {
+			const struct log_record *o = l->others[i];
+			if (o == NULL)
+				continue;
+			size_t j = hash_fnv1a(FNV_OFFSET, o->name, o->name_len);
+			while (t[j & (cap - 1)] != NULL)
+				j++;
+			t[j & (cap - 1)] = o;
+		}
+		free(l->others);
+		l->others = t;
+		l->others_mask = cap - 1;
+	}
+
+	size_t i = hash_fnv1a(FNV_OFFSET, r->name, r->name_len);
+	for (;; i++) {
+		const struct log_record **slot = &l->others[i & l->others_mask];
+		if (*slot == NULL) {
+			l->n_others++;
+			l->n_live++;
+		} else if ((*slot)->name_len != r->name_len
+				|| memcmp((*slot)->name, r->name, r->name_len) != 0) {
+			continue;
+		}
+		*slot = r;
+		return true;
+	}
+}
+
+/**
+ * Map the log and find the latest record of each target.  The latest records
+ * of names that are not in the makefile, which belong to other makefiles that
+ * share the log, are only kept for compaction.
+ *
+ * @return      false if the file is not a log.
+ */
+static bool load(build_log *l)
+{
+	struct stat st;
+	if (fstat(l->fd, &st) < 0 || (size_t)st.st_size < sizeof(struct log_header))
+		return false;
+
+	l->map_size = st.st_size;
+	l->map = mmap(NULL, l->map_size, PROT_READ, MAP_PRIVATE, l->fd, 0);
+	if (l->map == MAP_FAILED) {
+		l->map = NULL;
+		return false;
+	}
+
+	const struct log_header *h = l->map;
+	if (memcmp(h->magic, LOG_MAGIC, sizeof h->magic) != 0
+			|| h->byte_order != 0x0102030405060708)
+		return false;
+
+	size_t off = sizeof *h;
+	while (off + sizeof(struct log_record) <= l->map_size) {
+		const struct log_record *r = (const void *)((char *)l->map + off);
+		if (r->size % 8 != 0 || r->size < sizeof *r + r->name_len + 1
+				|| r->size > l->map_size - off || r->name[r->name_len] != '\0')
+			break;
+
+		node_id node = makefile_node(l->make, r->name);
+		if (node != NO_NODE) {
+			if (l->entries[node] == NULL)
+				l->n_live++;
+			l->entries[node] = &r->entry;
+		} else if (!l->others_lost && !add_other(l, r)) {
+			l->others_lost = true;
+		}
+		l->n_records++;
+		off += r->size;
+	}
+
+	// cut off a partly written record so that new records can follow
+	if (off < l->map_size && ftruncate(l->fd, off) < 0)
+		return false;
+
+	return true;
+}
+
+/**
+ * Forget what has been loaded from the log and unmap it.
+ */
+static void unload(build_log *l)
+{
+	if (l->map != NULL)
+		munmap(l->map, l->map_size);
+	l->map = NULL;
+	memset(l->entries, 0, makefile_nodes(l->make) * sizeof *l->entries);
+	free(l->others);
+	l->others = NULL;
+	l->others_mask = 0;
+	l->n_others = 0;
+	l->others_lost = false;
+	l->n_records = 0;
+	l->n_live = 0;
+}
+
+/**
+ * Open the file of a log for appending and load it, replacing it with an
+ * empty log if it cannot be loaded.
+ */
+static bool reopen(build_log *l)
+{
+	if (l->fd >= 0)
+		close(l->fd);
+	unload(l);
+
+	l->fd = open(l->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (l->fd < 0)
+		return false;
+
+	if (!load(l)) {
+		unload(l);
+		if (ftruncate(l->fd, 0) < 0 || !write_header(l->fd))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Rewrite a log with only the latest record of each target, whether it is in
+ * the makefile or not.  The new log replaces the old one atomically, so an
+ * interrupted compaction loses nothing.
+ */
+static bool compact(build_log *l)
+{
+	char *tmp;
+	int fd = temp_file_open(l->path, &tmp);
+	if (fd < 0)
+		return false;
+
+	bool ok = write_header(fd);
+	size_t n = makefile_nodes(l->make);
+	for (size_t i = 0; ok && i < n; i++)
+		if (l->entries[i] != NULL)
+			ok = write_record(fd, makefile_node_name(l->make, i),
+					l->entries[i]);
+	for (size_t i = 0; ok && l->others != NULL && i <= l->others_mask; i++)
+		if (l->others[i] != NULL)
+			ok = write_record(fd, l->others[i]->name,
+					&l->others[i]->entry);
+
+	ok = close(fd) == 0 && ok;
+	if (temp_file_finish(tmp, l->path, ok) < 0)
+		return false;
+
+	return reopen(l);
+}
+
+/**
+ * Open the log at a path, creating it if it does not exist or cannot be used.
+ * The log is compacted if most of its records have been superseded.
+ *
+ * @param path  Path of the log.
+ * @param m     The makefile, which must outlive the log.
+ * @return      The log, or NULL if it could not be opened.
+ */
+build_log *build_log_open(const char *path, makefile *m)
+{
+	build_log *l = calloc(1, sizeof *l);
+	if (l == NULL)
+		return NULL;
+
+	l->make = m;
+	l->fd = -1;
+	l->path = strdup(path);
+	l->entries = calloc(makefile_nodes(m), sizeof *l->entries);
+	if (l->path == NULL || l->entries == NULL || !reopen(l)) {
+		build_log_close(l);
+		return NULL;
+	}
+
+	if (!l->others_lost && l->n_records >= LOG_COMPACT_MIN
+			&& l->n_records > LOG_COMPACT_RATIO * l->n_live
+			&& !compact(l)) {
+		// the log is still usable if it could not be compacted
+		if (l->fd < 0 && !reopen(l)) {
+			build_log_close(l);
+			return NULL;
+		}
+	}
+
+	return l;
+}
+
+/**
+ * Get the latest record of a target, from this run or earlier runs.
+ *
+ * @param l     The log.
+ * @param node  Node of the target.
+ * @return      The record, or NULL if the target has not been built.
+ */
+const struct log_entry *build_log_get(build_log *l, node_id node)
+{
+	return l->entries[node];
+}
+
+/**
+ * Append a record for a target that has been built.
+ *
+ * @param l     The log.
+ * @param node  Node of the target.
+ * @param e     What to record.
+ * @return      0 on success, -1 if the record could not be written.
+ */
+int build_log_record(build_log *l, node_id node, const struct log_entry *e)
+{
+	// the record is kept in memory too, so that it is seen by later lookups
+	if (l->fresh == NULL)
+		l->fresh = calloc(makefile_nodes(l->make), sizeof *l->fresh);
+	if (l->fresh != NULL) {
+		l->fresh[node] = *e;
+		l->entries[node] = &l->fresh[node];
+	}
+
+	return write_record(l->fd, makefile_node_name(l->make, node), e) ? 0 : -1;
+}
+
+/**
+ * Hash the arguments of a command with 64-bit FNV-1a.  The terminating NUL of
+ * each argument is included, so that moving a space changes the hash.
+ *
+ * @param argv  The arguments, terminated by NULL.
+ * @return      The hash.
+ */
+uint64_t build_log_hash_cmd(char **argv)
+{
+	uint64_t h = FNV_OFFSET;
+
+	for (; *argv != NULL; argv++)
+		h = hash_fnv1a(h, *argv, strlen(*argv) + 1);
+
+	return h;
+}
+
+/**
+ * Hash the contents of a file.  The file is read in large blocks and hashed
+ * eight bytes at a time with a multiply and rotate per word, which is much
+ * faster than a byte at a time and good enough to tell contents apart.
+ *
+ * @param path  Path of the file.
+ * @param hash  Set to the hash, which is never 0.
+ * @return      0 on success, -1 if the file could not be read.
+ */
+int build_log_hash_file(const char *path, uint64_t *hash)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	uint64_t *buf = malloc(HASH_BUF);
+	if (buf == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	uint64_t h = 0x9e3779b97f4a7c15;
+	uint64_t total = 0;
+	ssize_t n;
+	while ((n = read(fd, buf, HASH_BUF)) > 0) {
+		// zero the tail of the last word so that it hashes the same every time
+		memset((char *)buf + n, 0, ALIGN8(n) - n);
+		for (size_t i = 0; i < ALIGN8(n) / 8; i++) {
+			h ^= buf[i] * 0xff51afd7ed558ccd;
+			h = (h << 31 | h >> 33) * 0xc4ceb9fe1a85ec53;
+		}
+		total += n;
+	}
+	free(buf);
+	close(fd);
+	if (n < 0)
+		return -1;
+
+	// the length tells apart files that only differ in trailing NULs
+	h ^= total;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccd;
+	h ^= h >> 33;
+	*hash = h != 0 ? h : 1;
+	return 0;
+}
+
+/**
+ * Close a log and free its memory.
+ *
+ * @param l     The log to close.
+ */
+void build_log_close(build_log *l)
+{
+	if (l->entries != NULL)
+		unload(l);
+	if (l->fd >= 0)
+		close(l->fd);
+	free(l->entries);
+	free(l->fresh);
+	free(l->path);
+	free(l);
+}
@@ -0,0 +1,87 @@
+/**
+ * Log of the targets built by earlier runs.  For every target that is built,
+ * a record with the time of its file, a hash of its command, how long the
+ * command took and optionally a hash of its contents is appended to the log.
+ * The log is mapped when it is opened, so reading it does not depend on the
+ * number of records, and it is rewritten with only the latest record of each
+ * target when old records dominate.
+ *
+ * @file buildlog.h
+ */
+#ifndef BUILDLOG_H
+#define BUILDLOG_H
+
+#include <stdint.h>
+#include "parser.h"
+#include "statcache.h"
+
+typedef struct build_log build_log;
+
+/**
+ * What is recorded about a target when it has been built.
+ */
+struct log_entry {
+	timestamp mtime;	// time of the file after the build, 0 if missing
+	uint64_t cmd_hash;	// hash of the command, see build_log_hash_cmd
+	uint64_t duration;	// in nanoseconds
+	uint64_t content_hash;	// hash of the file, 0 if not known
+	timestamp changed;	// time of the file when its contents last changed
+	uint64_t ino;		// inode and size of the file after the build
+	uint64_t size;
+};
+
+/**
+ * Open the log at a path, creating it if it does not exist or cannot be used.
+ * The log is compacted if most of its records have been superseded.
+ *
+ * @param path  Path of the log.
+ * @param m     The makefile, which must outlive the log.
+ * @return      The log, or NULL if it could not be opened.
+ */
+build_log *build_log_open(const char *path, makefile *m);
+
+/**
+ * Get the latest record of a target, from this run or earlier runs.
+ *
+ * @param l     The log.
+ * @param node  Node of the target.
+ * @return      The record, or NULL if the target has not been built.
+ */
+const struct log_entry *build_log_get(build_log *l, node_id node);
+
+/**
+ * Append a record for a target that has been built.  The record is written
+ * to the file at once, so it is kept even if mmake is interrupted.
+ *
+ * @param l     The log.
+ * @param node  Node of the target.
+ * @param e     What to record.
+ * @return      0 on success, -1 if the record could not be written.
+ */
+int build_log_record(build_log *l, node_id node, const struct log_entry *e);
+
+/**
+ * Hash the arguments of a command.
+ *
+ * @param argv  The arguments, terminated by NULL.
+ * @return      The hash.
+ */
+uint64_t build_log_hash_cmd(char **argv);
+
+/**
+ * Hash the contents of a file.
+ *
+ * @param path  Path of the file.
+ * @param hash  Set to the hash, which is never 0.
+ * @return      0 on success, -1 if the file could not be read.
+ */
+int build_log_hash_file(const char *path, uint64_t *hash);
+
+/**
+ * Close a log and free its memory.
+ *
+ * @param l     The log to close.
+ */
+void build_log_close(build_log *l);
+
+#endif
@@ -0,0 +1,211 @@
+/**
+ * Commands run inside mmake instead of as programs.
+ *
+ * @file builtins.c
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "builtins.h"
+
+#define COPY_CHUNK (1024 * 1024)
+
+struct builtin {
+	const char *name;
+	int (*run)(char **args);	// args follow the name, return as builtin_run
+};
+
+/**
+ * Check that none of the arguments is an option, which the builtins do not
+ * handle.  A lone "-" counts as an option, since it means standard input or
+ * output to most programs.
+ */
+static bool no_options(char **args)
+{
+	for (; *args != NULL; args++)
+		if ((*args)[0] == '-')
+			return false;
+
+	return true;
+}
+
+/**
+ * true and false ignore their arguments, except for GNU's --help and
+ * --version when they are the only one.
+ */
+static int run_true(char **args)
+{
+	return args[0] == NULL || args[1] != NULL || no_options(args) ? 0 : -1;
+}
+
+static int run_false(char **args)
+{
+	return args[0] == NULL || args[1] != NULL || no_options(args) ? 1 : -1;
+}
+
+/**
+ * touch creates each file that does not exist and sets the times of each file
+ * to now, the way GNU touch does: by opening the file, and by path if it
+ * cannot be opened for writing, such as a directory.
+ */
+static int run_touch(char **args)
+{
+	if (args[0] == NULL || !no_options(args))
+		return -1;
+
+	for (; *args != NULL; args++) {
+		int fd = open(*args, O_WRONLY | O_CREAT | O_NONBLOCK | O_NOCTTY
+				| O_CLOEXEC, 0666);
+		int r = fd >= 0 ? futimens(fd, NULL) : utimensat(AT_FDCWD, *args,
+				NULL, 0);
+
+		if (fd >= 0 && close(fd) != 0)
+			r = -1;
+		if (r != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * mkdir -p creates each directory and the directories leading to it, those
+ * in between with at least write and search permission for the owner.  It is
+ * not an error if a directory exists.
+ */
+static int run_mkdir(char **args)
+{
+	if (args[0] == NULL || strcmp(args[0], "-p") != 0 || args[1] == NULL
+			|| !no_options(args + 1))
+		return -1;
+
+	// directories in between would need their mode changed after creation
+	mode_t mask = umask(0);
+	umask(mask);
+	if (mask & (S_IWUSR | S_IXUSR))
+		return -1;
+
+	for (args++; *args != NULL; args++) {
+		// the command may be in read-only memory, so cut a copy of it
+		char *path = strdup(*args);
+		struct stat st;
+		bool ok = true;
+
+		if (path == NULL)
+			return -1;
+
+		for (char *p = path + 1; ok && *p != '\0'; p++) {
+			if (*p != '/' || p[-1] == '/')
+				continue;
+			*p = '\0';
+			ok = mkdir(path, 0777) == 0 || errno == EEXIST;
+			*p = '/';
+		}
+
+		if (ok && mkdir(path, 0777) != 0)
+			ok = errno == EEXIST && stat(path, &st) == 0
+				&& S_ISDIR(st.st_mode);
+		free(path);
+		if (!ok)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * cp copies a regular file to a path which is not a directory.  An existing
+ * file is truncated and keeps its mode, a new file gets the permissions of
+ * the source less the umask.  The data is copied in the kernel where it can
+ * be.
+ */
+static int run_cp(char **args)
+{
+	if (args[0] == NULL || args[1] == NULL || args[2] != NULL
+			|| !no_options(args))
+		return -1;
+
+	struct stat src, dst;
+	if (stat(args[0], &src) != 0 || !S_ISREG(src.st_mode))
+		return -1;
+
+	// a directory, a link or the source itself are left to cp
+	bool exists = lstat(args[1], &dst) == 0;
+	if (exists && (!S_ISREG(dst.st_mode) || (dst.st_dev == src.st_dev
+					&& dst.st_ino == src.st_ino)))
+		return -1;
+	if (!exists && errno != ENOENT)
+		return -1;
+
+	int in = open(args[0], O_RDONLY | O_CLOEXEC);
+	if (in < 0)
+		return -1;
+	int out = exists ? open(args[1], O_WRONLY | O_TRUNC | O_CLOEXEC)
+		: open(args[1], O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+				src.st_mode & 0777);
+	if (out < 0) {
+		close(in);
+		return -1;
+	}
+
+	ssize_t n;
+	bool in_kernel = true;
+	char *buf = NULL;
+	for (;;) {
+		if (in_kernel) {
+			n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+			if (n < 0 && (errno == EXDEV || errno == ENOSYS
+						|| errno == EINVAL || errno == EOPNOTSUPP)) {
+				in_kernel = false;
+				continue;
+			}
+		} else {
+			if (buf == NULL && (buf = malloc(COPY_CHUNK)) == NULL) {
+				n = -1;
+				break;
+			}
+			n = read(in, buf, COPY_CHUNK);
+			if (n > 0 && write(out, buf, n) != n)
+				n = -1;
+		}
+		if (n <= 0)
+			break;
+	}
+
+	free(buf);
+	close(in);
+	if (close(out) != 0 || n < 0)
+		return -1;
+
+	return 0;
+}
+
+static const struct builtin builtins[] = {
+	{ "true", run_true },
+	{ "false", run_false },
+	{ "touch", run_touch },
+	{ "mkdir", run_mkdir },
+	{ "cp", run_cp },
+};
+
+/**
+ * Run a command in-process if it is a builtin.  Only commands named without
+ * a path are builtins, so a command such as ./touch is always run.
+ *
+ * @param argv  The command, terminated by NULL.
+ * @return      The exit status of the command, or -1 if the command must be
+ *              run as a program.
+ */
+int builtin_run(char **argv)
+{
+	for (size_t i = 0; i < sizeof builtins / sizeof *builtins; i++)
+		if (strcmp(argv[0], builtins[i].name) == 0)
+			return builtins[i].run(argv + 1);
+
+	return -1;
+}
@@ -0,0 +1,26 @@
+/**
+ * Commands run inside mmake instead of as programs.  Rules which only touch
+ * a stamp, create a directory or copy a file are common, and running such a
+ * command in-process saves starting a program and waiting for it.
+ *
+ * The builtins are true, false, touch with no options, mkdir -p and cp of one
+ * file to another with no options.  A builtin does what the program would do
+ * when it succeeds.  Any other form of these commands, and any error, is left
+ * to the program, so messages and exit codes are those of the program.
+ *
+ * @file builtins.h
+ */
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+/**
+ * Run a command in-process if it is a builtin.
+ *
+ * @param argv  The command, terminated by NULL.
+ * @return      The exit status of the command, or -1 if the command must be
+ *              run as a program.  A command that failed part way may have
+ *              done some of its work, which running the program does again.
+ */
+int builtin_run(char **argv);
+
+#endif
@@ -0,0 +1,266 @@
+/**
+ * Capture of the output of a command.
+ *
+ * @file capture.c
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "capture.h"
+
+#define CAPTURE_PIPE_SIZE (1024 * 1024)
+#define SCRATCH_SIZE (64 * 1024)
+
+/**
+ * Output is moved from its pipe into buf each time the pipe becomes readable,
+ * so that the command never blocks on it.  How full a pipe is cannot be told
+ * from the number of bytes in it, since small writes that are not merged
+ * each take a slot of their own.  What comes in after the last read is
+ * spliced to its destination at the end.  The amount in a pipe is always
+ * asked for with FIONREAD, so reading from it never blocks.
+ */
+struct stream {
+	int fd;			// read end, -1 if not used
+	int child_fd;		// write end, -1 once closed
+	char *buf;
+	size_t len;
+	size_t cap;
+};
+
+struct capture {
+	struct stream s[2];	// standard output and standard error
+};
+
+/**
+ * Get the number of bytes that can be read from a pipe without blocking.
+ */
+static size_t available(int fd)
+{
+	int n;
+
+	return ioctl(fd, FIONREAD, &n) == 0 && n > 0 ? (size_t)n : 0;
+}
+
+/**
+ * Write all of buf to fd, waiting if fd is non-blocking and full.
+ */
+static void write_full(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EAGAIN) {
+			struct pollfd p = { .fd = fd, .events = POLLOUT };
+			poll(&p, 1, -1);
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+static bool open_stream(struct stream *s)
+{
+	int p[2];
+	if (pipe2(p, O_CLOEXEC) < 0)
+		return false;
+
+	s->fd = p[0];
+	s->child_fd = p[1];
+
+	// a larger pipe lets the command write more before mmake gets to it
+	fcntl(s->fd, F_SETPIPE_SZ, CAPTURE_PIPE_SIZE);
+	return true;
+}
+
+static void close_stream(struct stream *s)
+{
+	if (s->fd >= 0)
+		close(s->fd);
+	if (s->child_fd >= 0)
+		close(s->child_fd);
+	free(s->buf);
+}
+
+/**
+ * Create pipes to capture the output of a command.
+ *
+ * @param merged    Capture standard output and standard error in one pipe.
+ * @return          The capture, or NULL with errno set on failure.
+ */
+capture *capture_new(bool merged)
+{
+	capture *c = calloc(1, sizeof *c);
+	if (c == NULL)
+		return NULL;
+
+	c->s[0].fd = c->s[0].child_fd = -1;
+	c->s[1].fd = c->s[1].child_fd = -1;
+	if (!open_stream(&c->s[0]) || (!merged && !open_stream(&c->s[1]))) {
+		int err = errno;
+		capture_del(c);
+		errno = err;
+		return NULL;
+	}
+
+	return c;
+}
+
+/**
+ * Get the file descriptor a command should have as its standard output or
+ * standard error.
+ *
+ * @param c         The capture.
+ * @param stream    1 for standard output, 2 for standard error.
+ * @return          The write end of a pipe.
+ */
+int capture_child_fd(capture *c, int stream)
+{
+	if (stream == 2 && c->s[1].child_fd >= 0)
+		return c->s[1].child_fd;
+
+	return c->s[0].child_fd;
+}
+
+/**
+ * Close the write ends of the pipes.
+ *
+ * @param c     The capture.
+ */
+void capture_started(capture *c)
+{
+	for (int i = 0; i < 2; i++) {
+		if (c->s[i].child_fd >= 0)
+			close(c->s[i].child_fd);
+		c->s[i].child_fd = -1;
+	}
+}
+
+/**
+ * Get a file descriptor to watch for output of the command.
+ *
+ * @param c         The capture.
+ * @param stream    1 for standard output, 2 for standard error.
+ * @return          The read end of a pipe, or -1 if not used.
+ */
+int capture_watch_fd(capture *c, int stream)
+{
+	return c->s[stream == 2].fd;
+}
+
+/**
+ * Collect all output that can be read from one of the pipes of a capture.
+ *
+ * @param c     The capture.
+ * @param fd    The pipe that has become readable.
+ * @return      true if fd belongs to the capture.
+ */
+bool capture_collect(capture *c, int fd)
+{
+	struct stream *s;
+	if (fd >= 0 && fd == c->s[0].fd)
+		s = &c->s[0];
+	else if (fd >= 0 && fd == c->s[1].fd)
+		s = &c->s[1];
+	else
+		return false;
+
+	size_t n;
+	while ((n = available(s->fd)) > 0) {
+		if (s->len + n > s->cap) {
+			size_t cap = 2 * (s->len + n);
+			char *buf = realloc(s->buf, cap);
+			if (buf == NULL) {
+				// without memory the output is lost rather than the
+				// command left blocked
+				char scratch[SCRATCH_SIZE];
+				ssize_t r = 1;
+				for (; n > 0 && r > 0; n -= r)
+					r = read(s->fd, scratch, n < sizeof scratch ? n
+							: sizeof scratch);
+				return true;
+			}
+			s->buf = buf;
+			s->cap = cap;
+		}
+
+		ssize_t r = read(s->fd, s->buf + s->len, n);
+		if (r <= 0)
+			break;
+		s->len += r;
+	}
+
+	return true;
+}
+
+/**
+ * Write the output of a stream to dest.  What is still in the pipe is moved
+ * with splice(), so it is not copied through mmake, unless dest does not
+ * support it.
+ */
+static void flush_stream(struct stream *s, int dest)
+{
+	if (s->fd < 0)
+		return;
+
+	if (dest >= 0)
+		write_full(dest, s->buf, s->len);
+	s->len = 0;
+
+	bool can_splice = dest >= 0;
+	char scratch[SCRATCH_SIZE];
+	size_t n;
+	while ((n = available(s->fd)) > 0) {
+		if (can_splice) {
+			ssize_t r = splice(s->fd, NULL, dest, NULL, n, 0);
+			if (r > 0 || (r < 0 && errno == EINTR))
+				continue;
+			if (r < 0 && errno == EAGAIN) {
+				struct pollfd p = { .fd = dest, .events = POLLOUT };
+				poll(&p, 1, -1);
+				continue;
+			}
+			can_splice = false;
+		}
+
+		ssize_t r = read(s->fd, scratch, n < sizeof scratch ? n
+				: sizeof scratch);
+		if (r <= 0)
+			break;
+		if (dest >= 0)
+			write_full(dest, scratch, r);
+	}
+}
+
+/**
+ * Write all output captured so far to its destinations.
+ *
+ * @param c         The capture.
+ * @param out_fd    Destination of standard output, -1 to discard it.
+ * @param err_fd    Destination of standard error, -1 to discard it.
+ */
+void capture_flush(capture *c, int out_fd, int err_fd)
+{
+	flush_stream(&c->s[0], out_fd);
+	flush_stream(&c->s[1], err_fd);
+}
+
+/**
+ * Close the pipes of a capture and free its memory.
+ *
+ * @param c     The capture to delete.
+ */
+void capture_del(capture *c)
+{
+	close_stream(&c->s[0]);
+	close_stream(&c->s[1]);
+	free(c);
+}
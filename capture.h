@@ -0,0 +1,81 @@
+/**
+ * Capture of the output of a command, so that the output of commands running
+ * at the same time is not interleaved.  The output is collected from pipes
+ * while the command runs and written out in one piece when it has finished.
+ *
+ * @file capture.h
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+
+typedef struct capture capture;
+
+/**
+ * Create pipes to capture the output of a command.
+ *
+ * @param merged    Capture standard output and standard error in one pipe,
+ *                  for when both go to the same file, so that their order is
+ *                  kept.
+ * @return          The capture, or NULL with errno set on failure.
+ */
+capture *capture_new(bool merged);
+
+/**
+ * Get the file descriptor a command should have as its standard output or
+ * standard error.
+ *
+ * @param c         The capture.
+ * @param stream    1 for standard output, 2 for standard error.
+ * @return          The write end of a pipe.
+ */
+int capture_child_fd(capture *c, int stream);
+
+/**
+ * Close the write ends of the pipes once the command has been started, so
+ * that only the command holds them.
+ *
+ * @param c     The capture.
+ */
+void capture_started(capture *c);
+
+/**
+ * Get a file descriptor to watch for output of the command.
+ *
+ * @param c         The capture.
+ * @param stream    1 for standard output, 2 for standard error.
+ * @return          The read end of a pipe, or -1 if the stream is merged
+ *                  into standard output.
+ */
+int capture_watch_fd(capture *c, int stream);
+
+/**
+ * Collect all output that can be read from one of the pipes of a capture,
+ * so that the command does not block.  To be called each time the pipe is
+ * readable.
+ *
+ * @param c     The capture.
+ * @param fd    The pipe that is readable.
+ * @return      true if fd belongs to the capture.
+ */
+bool capture_collect(capture *c, int fd);
+
+/**
+ * Write all output captured so far to its destinations.  Standard output goes
+ * to out_fd and standard error to err_fd, or to out_fd if they are merged.
+ *
+ * @param c         The capture.
+ * @param out_fd    Destination of standard output, -1 to discard it.
+ * @param err_fd    Destination of standard error, -1 to discard it.
+ */
+void capture_flush(capture *c, int out_fd, int err_fd);
+
+/**
+ * Close the pipes of a capture and free its memory.
+ *
+ * @param c     The capture to delete.
+ */
+void capture_del(capture *c);
+
+#endif
@@ -0,0 +1,283 @@
+/**
+ * Loop waiting for the events mmake reacts to while commands run.
+ *
+ * @file eventloop.c
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "eventloop.h"
+
+/**
+ * What an epoll event is about is kept in its data: a tag in the top bits,
+ * then a file descriptor and, for a pidfd, the pid of its child.
+ */
+#define TAG_SIGNAL 0
+#define TAG_CHILD 1
+#define TAG_FD 2
+#define PACK(tag, fd, pid) ((uint64_t)(tag) << 62 | (uint64_t)(fd) << 32 \
+		| (uint32_t)(pid))
+#define TAG_OF(u) ((int)((u) >> 62))
+#define FD_OF(u) ((int)(((u) >> 32) & 0x3fffffff))
+#define PID_OF(u) ((pid_t)(uint32_t)(u))
+
+struct event_loop {
+	int epoll_fd;
+	int signal_fd;
+	bool pidfds;		// children are watched through pidfds
+	pid_t *children;	// watched through SIGCHLD and not yet reaped
+	size_t n_children;
+	size_t children_cap;
+	sigset_t old_mask;
+};
+
+const int stop_signals[N_STOP_SIGNALS] = { SIGINT, SIGTERM, SIGHUP };
+
+/**
+ * Check if the kernel has pidfd_open().
+ */
+static bool have_pidfds(void)
+{
+	int fd = syscall(__NR_pidfd_open, getpid(), 0);
+	if (fd < 0)
+		return false;
+
+	close(fd);
+	return true;
+}
+
+/**
+ * Get the stop signals that are not ignored.
+ *
+ * @param set   Set to the signals.
+ */
+void stop_signals_handled(sigset_t *set)
+{
+	sigemptyset(set);
+	for (int i = 0; i < N_STOP_SIGNALS; i++) {
+		struct sigaction sa;
+		if (sigaction(stop_signals[i], NULL, &sa) == 0
+				&& sa.sa_handler != SIG_IGN)
+			sigaddset(set, stop_signals[i]);
+	}
+}
+
+/**
+ * Create an event loop.  The signals it reports are blocked in all threads
+ * created after it, and read from a signalfd.
+ *
+ * @return      The loop, or NULL with errno set if it could not be created.
+ */
+event_loop *event_loop_new(void)
+{
+	event_loop *l = calloc(1, sizeof *l);
+	if (l == NULL)
+		return NULL;
+
+	sigset_t set;
+	stop_signals_handled(&set);
+	l->pidfds = have_pidfds();
+	if (!l->pidfds)
+		sigaddset(&set, SIGCHLD);
+
+	l->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	l->signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	struct epoll_event e = { .events = EPOLLIN,
+		.data.u64 = PACK(TAG_SIGNAL, l->signal_fd, 0) };
+	if (l->epoll_fd < 0 || l->signal_fd < 0
+			|| epoll_ctl(l->epoll_fd, EPOLL_CTL_ADD, l->signal_fd, &e) < 0) {
+		int err = errno;
+		if (l->epoll_fd >= 0)
+			close(l->epoll_fd);
+		if (l->signal_fd >= 0)
+			close(l->signal_fd);
+		free(l);
+		errno = err;
+		return NULL;
+	}
+
+	pthread_sigmask(SIG_BLOCK, &set, &l->old_mask);
+	return l;
+}
+
+/**
+ * Get the signal mask mmake had before the loop blocked signals.
+ *
+ * @param l     The loop.
+ * @return      The signal mask.
+ */
+const sigset_t *event_loop_sigmask(event_loop *l)
+{
+	return &l->old_mask;
+}
+
+/**
+ * Watch a child through a pidfd, or add it to the children to reap on
+ * SIGCHLD.
+ *
+ * @param l     The loop.
+ * @param pid   The child.
+ * @return      0 on success, -1 with errno set on failure.
+ */
+int event_loop_watch_child(event_loop *l, pid_t pid)
+{
+	if (!l->pidfds) {
+		if (l->n_children == l->children_cap) {
+			size_t cap = l->children_cap ? 2 * l->children_cap : 16;
+			pid_t *children = realloc(l->children, cap * sizeof *children);
+			if (children == NULL)
+				return -1;
+			l->children = children;
+			l->children_cap = cap;
+		}
+		l->children[l->n_children++] = pid;
+		return 0;
+	}
+
+	int fd = syscall(__NR_pidfd_open, pid, 0);
+	if (fd < 0)
+		return -1;
+
+	struct epoll_event e = { .events = EPOLLIN,
+		.data.u64 = PACK(TAG_CHILD, fd, pid) };
+	if (epoll_ctl(l->epoll_fd, EPOLL_CTL_ADD, fd, &e) < 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Watch a file descriptor for reading, edge triggered if asked to.
+ *
+ * @param l     The loop.
+ * @param fd    The file descriptor.
+ * @param edge  Report only when more can be read.
+ * @return      0 on success, -1 with errno set on failure.
+ */
+int event_loop_watch_fd(event_loop *l, int fd, bool edge)
+{
+	struct epoll_event e = { .events = EPOLLIN | (edge ? EPOLLET : 0),
+		.data.u64 = PACK(TAG_FD, fd, 0) };
+
+	return epoll_ctl(l->epoll_fd, EPOLL_CTL_ADD, fd, &e);
+}
+
+/**
+ * Stop watching a file descriptor.
+ *
+ * @param l     The loop.
+ * @param fd    The file descriptor.
+ */
+void event_loop_unwatch_fd(event_loop *l, int fd)
+{
+	epoll_ctl(l->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/**
+ * Reap a watched child that has exited, without waiting.  Only the watched
+ * children are waited for, so other children of mmake, like launchers, are
+ * left alone.
+ */
+static bool reap_child(event_loop *l, struct event *ev)
+{
+	for (size_t i = 0; i < l->n_children; i++) {
+		pid_t pid = waitpid(l->children[i], &ev->status, WNOHANG);
+		if (pid > 0) {
+			l->children[i] = l->children[--l->n_children];
+			ev->kind = EVENT_CHILD;
+			ev->pid = pid;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Wait for the next event.  Without pidfds, children that have exited are
+ * reaped before waiting, since SIGCHLD is only reported once for several
+ * children.
+ *
+ * @param l     The loop.
+ * @param ev    Set to the event.
+ * @return      0 on success, -1 with errno set on failure.
+ */
+int event_loop_wait(event_loop *l, struct event *ev)
+{
+	for (;;) {
+		if (reap_child(l, ev))
+			return 0;
+
+		struct epoll_event e;
+		int n = epoll_wait(l->epoll_fd, &e, 1, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+
+		switch (TAG_OF(e.data.u64)) {
+		case TAG_SIGNAL:
+			if ((ev->signo = event_loop_poll_signal(l)) == 0)
+				continue;
+			ev->kind = EVENT_SIGNAL;
+			return 0;
+		case TAG_CHILD:
+			ev->kind = EVENT_CHILD;
+			ev->pid = PID_OF(e.data.u64);
+			while (waitpid(ev->pid, &ev->status, 0) < 0)
+				if (errno != EINTR)
+					return -1;
+			epoll_ctl(l->epoll_fd, EPOLL_CTL_DEL, FD_OF(e.data.u64), NULL);
+			close(FD_OF(e.data.u64));
+			return 0;
+		default:
+			ev->kind = EVENT_FD;
+			ev->fd = FD_OF(e.data.u64);
+			return 0;
+		}
+	}
+}
+
+/**
+ * Check, without waiting, whether mmake has been told to stop.  SIGCHLD read
+ * on the way is dropped, since children are reaped by waiting for them.
+ *
+ * @param l     The loop.
+ * @return      The signal that was received, or 0 if none was.
+ */
+int event_loop_poll_signal(event_loop *l)
+{
+	struct signalfd_siginfo si;
+
+	while (read(l->signal_fd, &si, sizeof si) == sizeof si)
+		if (si.ssi_signo != SIGCHLD)
+			return si.ssi_signo;
+
+	return 0;
+}
+
+/**
+ * Free an event loop and restore the signal mask.
+ *
+ * @param l     The loop to delete.
+ */
+void event_loop_del(event_loop *l)
+{
+	close(l->signal_fd);
+	close(l->epoll_fd);
+	pthread_sigmask(SIG_SETMASK, &l->old_mask, NULL);
+	free(l->children);
+	free(l);
+}
@@ -0,0 +1,116 @@
+/**
+ * Loop waiting for the events mmake reacts to while commands run: a command
+ * that exits, a file descriptor that can be read and a signal telling mmake
+ * to stop.  All of them are waited for at once with epoll.  Commands are
+ * watched through pidfds, or through SIGCHLD if the kernel has no pidfds,
+ * and signals through a signalfd.
+ *
+ * @file eventloop.h
+ */
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+typedef struct event_loop event_loop;
+
+/* Signals that tell mmake to stop: SIGINT, SIGTERM and SIGHUP */
+#define N_STOP_SIGNALS 3
+extern const int stop_signals[N_STOP_SIGNALS];
+
+enum event_kind {
+	EVENT_CHILD,	// a watched child has exited and been reaped
+	EVENT_FD,	// a watched file descriptor can be read
+	EVENT_SIGNAL,	// mmake has been told to stop
+};
+
+struct event {
+	enum event_kind kind;
+	pid_t pid;	// the child, for EVENT_CHILD
+	int status;	// of the child as from waitpid(), for EVENT_CHILD
+	int fd;		// for EVENT_FD
+	int signo;	// for EVENT_SIGNAL
+};
+
+/**
+ * Get the stop signals that mmake handles, which are those it was not started
+ * to ignore.  An ignored signal is left ignored, as the shell asked for.
+ *
+ * @param set   Set to the signals.
+ */
+void stop_signals_handled(sigset_t *set);
+
+/**
+ * Create an event loop.  SIGINT, SIGTERM and SIGHUP are blocked from then on
+ * and reported as events instead, unless they were ignored.
+ *
+ * @return      The loop, or NULL with errno set if it could not be created.
+ */
+event_loop *event_loop_new(void);
+
+/**
+ * Get the signal mask mmake had before the loop blocked signals, which
+ * commands should be started with.
+ *
+ * @param l     The loop.
+ * @return      The signal mask.
+ */
+const sigset_t *event_loop_sigmask(event_loop *l);
+
+/**
+ * Watch a child, so that an EVENT_CHILD is reported when it exits.
+ *
+ * @param l     The loop.
+ * @param pid   The child.
+ * @return      0 on success, -1 with errno set on failure.
+ */
+int event_loop_watch_child(event_loop *l, pid_t pid);
+
+/**
+ * Watch a file descriptor, so that an EVENT_FD is reported while it can be
+ * read, or with edge each time more can be read.
+ *
+ * @param l     The loop.
+ * @param fd    The file descriptor.
+ * @param edge  Report only when more can be read, so that data may be left
+ *              unread without the event being reported again.
+ * @return      0 on success, -1 with errno set on failure.
+ */
+int event_loop_watch_fd(event_loop *l, int fd, bool edge);
+
+/**
+ * Stop watching a file descriptor.  This must be done before it is closed.
+ *
+ * @param l     The loop.
+ * @param fd    The file descriptor.
+ */
+void event_loop_unwatch_fd(event_loop *l, int fd);
+
+/**
+ * Wait for the next event.
+ *
+ * @param l     The loop.
+ * @param ev    Set to the event.
+ * @return      0 on success, -1 with errno set on failure.
+ */
+int event_loop_wait(event_loop *l, struct event *ev);
+
+/**
+ * Check, without waiting, whether mmake has been told to stop.
+ *
+ * @param l     The loop.
+ * @return      The signal that was received, or 0 if none was.
+ */
+int event_loop_poll_signal(event_loop *l);
+
+/**
+ * Free an event loop and unblock its signals, so that signals received and
+ * not yet reported are delivered.
+ *
+ * @param l     The loop to delete.
+ */
+void event_loop_del(event_loop *l);
+
+#endif
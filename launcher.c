@@ -0,0 +1,371 @@
+/**
+ * Pool of launcher processes which start commands for mmake.
+ *
+ * @file launcher.c
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "launcher.h"
+#include "eventloop.h"
+
+/**
+ * Each launcher reads commands from a socket of its own.  A command is sent
+ * as its size followed by its arguments, each terminated by a NUL, with the
+ * standard output and standard error for it passed along with the size if it
+ * is not to inherit those of mmake.  All launchers write their results to one
+ * pipe, which is atomic since a result is smaller than PIPE_BUF.
+ */
+struct launcher {
+	pid_t pid;
+	int cmd_fd;		// mmake's end of the socket of commands
+	bool busy;
+};
+
+struct launcher_pool {
+	struct launcher *launchers;
+	int n;
+	int result_fd;		// read end of the pipe of results
+};
+
+struct launch_result {
+	int32_t pid;		// of the launcher
+	int32_t status;
+	int32_t error;
+};
+
+/* The command a launcher is running, to pass signals on to */
+static volatile sig_atomic_t running;
+
+/* A signal that came while no command was running */
+static volatile sig_atomic_t pending;
+
+/**
+ * Pass a signal telling the launcher to stop on to its command.  The launcher
+ * itself goes on, to report how the command ended.  Without a command the
+ * signal is kept for the next one: mmake only signals a launcher it has sent
+ * a command to, which may not have been started yet, and starts no more
+ * commands once told to stop.
+ */
+static void forward_signal(int signo)
+{
+	if (running > 0)
+		kill(running, signo);
+	else
+		pending = signo;
+}
+
+/**
+ * Read exactly size bytes, unless the end of the file comes first.
+ */
+static bool read_full(int fd, void *buf, size_t size)
+{
+	char *p = buf;
+
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+/**
+ * Read the size of the next command from cmd_fd, and the file descriptors
+ * passed with it into fds.  fds is left as it is if none were passed.
+ */
+static bool read_header(int cmd_fd, uint32_t *size, int fds[2])
+{
+	union {
+		struct cmsghdr h;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct iovec iov = { .iov_base = size, .iov_len = sizeof *size };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof control.buf,
+	};
+
+	ssize_t n;
+	while ((n = recvmsg(cmd_fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+		;
+	if (n <= 0)
+		return false;
+
+	struct cmsghdr *h = CMSG_FIRSTHDR(&msg);
+	if (h != NULL && h->cmsg_level == SOL_SOCKET && h->cmsg_type == SCM_RIGHTS
+			&& h->cmsg_len == CMSG_LEN(2 * sizeof(int)))
+		memcpy(fds, CMSG_DATA(h), 2 * sizeof(int));
+
+	// the rest of the size, in the unlikely case that it came in parts
+	return read_full(cmd_fd, (char *)size + n, sizeof *size - n);
+}
+
+/**
+ * Run the commands read from cmd_fd one at a time and write the result of
+ * each to result_fd.  This is all a launcher does, until mmake closes its
+ * end of the socket.
+ */
+static void launcher_main(int cmd_fd, int result_fd)
+{
+	uint32_t size;
+	sigset_t handled;
+
+	stop_signals_handled(&handled);
+	for (int i = 0; i < N_STOP_SIGNALS; i++) {
+		if (sigismember(&handled, stop_signals[i])) {
+			struct sigaction sa = { .sa_handler = forward_signal };
+			sigemptyset(&sa.sa_mask);
+			sigaction(stop_signals[i], &sa, NULL);
+		}
+	}
+
+	int fds[2] = { -1, -1 };
+	while (read_header(cmd_fd, &size, fds)) {
+		char *buf = malloc(size);
+		if (buf == NULL || !read_full(cmd_fd, buf, size))
+			_exit(EXIT_FAILURE);
+
+		size_t argc = 0;
+		for (uint32_t i = 0; i < size; i++)
+			argc += buf[i] == '\0';
+		char **argv = malloc((argc + 1) * sizeof *argv);
+		if (argv == NULL)
+			_exit(EXIT_FAILURE);
+		for (size_t i = 0, off = 0; i < argc; i++) {
+			argv[i] = buf + off;
+			off += strlen(argv[i]) + 1;
+		}
+		argv[argc] = NULL;
+
+		// the output of the command goes where mmake has asked for
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		for (int i = 0; i < 2; i++)
+			if (fds[i] >= 0)
+				posix_spawn_file_actions_adddup2(&actions, fds[i], i + 1);
+
+		struct launch_result r = { .pid = getpid() };
+		pid_t child;
+		int status;
+		r.error = posix_spawnp(&child, argv[0], &actions, NULL, argv, environ);
+		posix_spawn_file_actions_destroy(&actions);
+		for (int i = 0; i < 2; i++) {
+			if (fds[i] >= 0)
+				close(fds[i]);
+			fds[i] = -1;
+		}
+		if (r.error == 0) {
+			// a signal that came before running was set has to be
+			// passed on here, since the handler could not
+			running = child;
+			if (pending != 0) {
+				kill(child, pending);
+				pending = 0;
+			}
+			while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+				;
+			r.status = status;
+			running = 0;
+		}
+
+		free(argv);
+		free(buf);
+		if (write(result_fd, &r, sizeof r) != sizeof r)
+			_exit(EXIT_FAILURE);
+	}
+
+	_exit(EXIT_SUCCESS);
+}
+
+/**
+ * Fork a pool of launchers.
+ *
+ * @param n     Number of launchers.
+ * @return      The pool, or NULL with errno set if it could not be started.
+ */
+launcher_pool *launcher_pool_new(int n)
+{
+	int result[2];
+	launcher_pool *p = calloc(1, sizeof *p);
+	if (p == NULL)
+		return NULL;
+
+	p->launchers = calloc(n, sizeof *p->launchers);
+	if (p->launchers == NULL || pipe2(result, O_CLOEXEC) < 0) {
+		free(p->launchers);
+		free(p);
+		return NULL;
+	}
+	p->result_fd = result[0];
+
+	for (; p->n < n; p->n++) {
+		int cmd[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, cmd) < 0)
+			break;
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			// keep only the socket and pipe of this launcher, so that each
+			// one sees the end of its socket when mmake exits
+			for (int i = 0; i < p->n; i++)
+				close(p->launchers[i].cmd_fd);
+			close(cmd[1]);
+			close(result[0]);
+			launcher_main(cmd[0], result[1]);
+		}
+
+		close(cmd[0]);
+		if (pid < 0) {
+			close(cmd[1]);
+			break;
+		}
+		p->launchers[p->n].pid = pid;
+		p->launchers[p->n].cmd_fd = cmd[1];
+	}
+	close(result[1]);
+
+	if (p->n < n) {
+		int err = errno;
+		launcher_pool_del(p);
+		errno = err;
+		return NULL;
+	}
+
+	return p;
+}
+
+/**
+ * Send a command to an idle launcher in a single message.
+ *
+ * @param p         The pool.
+ * @param argv      The command, terminated by NULL.
+ * @param out_fd    Standard output of the command, -1 for that of mmake.
+ * @param err_fd    Standard error of the command, -1 for that of mmake.
+ * @return          The pid of the launcher, or -1 with errno set.
+ */
+pid_t launcher_pool_run(launcher_pool *p, char **argv, int out_fd,
+		int err_fd)
+{
+	struct launcher *l = NULL;
+	for (int i = 0; l == NULL && i < p->n; i++)
+		if (!p->launchers[i].busy)
+			l = &p->launchers[i];
+	if (l == NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	size_t size = 0;
+	for (char **a = argv; *a != NULL; a++)
+		size += strlen(*a) + 1;
+
+	char *msg = malloc(sizeof(uint32_t) + size);
+	if (msg == NULL)
+		return -1;
+	uint32_t size32 = size;
+	memcpy(msg, &size32, sizeof size32);
+	char *end = msg + sizeof size32;
+	for (char **a = argv; *a != NULL; a++)
+		end = stpcpy(end, *a) + 1;
+
+	union {
+		struct cmsghdr h;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct iovec iov = { .iov_base = msg, .iov_len = end - msg };
+	struct msghdr m = { .msg_iov = &iov, .msg_iovlen = 1 };
+	if (out_fd >= 0 || err_fd >= 0) {
+		int fds[2] = { out_fd, err_fd };
+		m.msg_control = control.buf;
+		m.msg_controllen = sizeof control.buf;
+		struct cmsghdr *h = CMSG_FIRSTHDR(&m);
+		h->cmsg_level = SOL_SOCKET;
+		h->cmsg_type = SCM_RIGHTS;
+		h->cmsg_len = CMSG_LEN(sizeof fds);
+		memcpy(CMSG_DATA(h), fds, sizeof fds);
+	}
+
+	ssize_t n;
+	while ((n = sendmsg(l->cmd_fd, &m, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+	free(msg);
+	if (n != (ssize_t)iov.iov_len) {
+		if (n >= 0)
+			errno = EIO;
+		return -1;
+	}
+
+	l->busy = true;
+	return l->pid;
+}
+
+/**
+ * Get the read end of the pipe of results.
+ *
+ * @param p     The pool.
+ * @return      The file descriptor.
+ */
+int launcher_pool_fd(launcher_pool *p)
+{
+	return p->result_fd;
+}
+
+/**
+ * Wait for a command started by any launcher to finish.
+ *
+ * @param p         The pool.
+ * @param status    Set to the status of the command.
+ * @param error     Set to the errno of starting the command, or 0.
+ * @return          The pid of the launcher, or -1 with errno set.
+ */
+pid_t launcher_pool_wait(launcher_pool *p, int *status, int *error)
+{
+	struct launch_result r;
+
+	errno = 0;
+	if (!read_full(p->result_fd, &r, sizeof r)) {
+		// the end of the pipe means that all launchers have exited
+		if (errno == 0)
+			errno = ECHILD;
+		return -1;
+	}
+
+	for (int i = 0; i < p->n; i++)
+		if (p->launchers[i].pid == r.pid)
+			p->launchers[i].busy = false;
+	*status = r.status;
+	*error = r.error;
+	return r.pid;
+}
+
+/**
+ * Make the launchers exit once they are idle and free the pool.  Closing the
+ * sockets of commands is what tells the launchers to exit.
+ *
+ * @param p     The pool to delete.
+ */
+void launcher_pool_del(launcher_pool *p)
+{
+	for (int i = 0; i < p->n; i++)
+		close(p->launchers[i].cmd_fd);
+	close(p->result_fd);
+	free(p->launchers);
+	free(p);
+}
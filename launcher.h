@@ -0,0 +1,69 @@
+/**
+ * Pool of launcher processes which start commands for mmake.  The launchers
+ * are forked when mmake starts, while it is still small, and each of them
+ * runs one command at a time that it is sent over a socket.  mmake itself then
+ * never forks while it holds the makefile and its caches, and it can go on
+ * with the graph while a launcher starts a command.
+ *
+ * @file launcher.h
+ */
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <sys/types.h>
+
+typedef struct launcher_pool launcher_pool;
+
+/**
+ * Fork a pool of launchers.
+ *
+ * @param n     Number of launchers, which is how many commands can run at
+ *              the same time.
+ * @return      The pool, or NULL with errno set if it could not be started.
+ */
+launcher_pool *launcher_pool_new(int n);
+
+/**
+ * Send a command to an idle launcher, which starts it.  A SIGINT, SIGTERM or
+ * SIGHUP sent to the launcher is passed on to the command.
+ *
+ * @param p         The pool.
+ * @param argv      The command, terminated by NULL.
+ * @param out_fd    Standard output of the command, -1 for that of mmake.
+ * @param err_fd    Standard error of the command, -1 for that of mmake.
+ * @return          The pid of the launcher, which identifies the command until
+ *                  it is waited for, or -1 with errno set if no launcher is
+ *                  idle or the command could not be sent.
+ */
+pid_t launcher_pool_run(launcher_pool *p, char **argv, int out_fd,
+		int err_fd);
+
+/**
+ * Get the file descriptor that can be read when a command started by a
+ * launcher has finished, so that it can be waited for with other events.
+ *
+ * @param p     The pool.
+ * @return      The file descriptor.
+ */
+int launcher_pool_fd(launcher_pool *p);
+
+/**
+ * Wait for a command started by any launcher to finish.
+ *
+ * @param p         The pool.
+ * @param status    Set to the status of the command, as from waitpid().
+ * @param error     Set to the errno of starting the command if it could not
+ *                  be started, otherwise 0.
+ * @return          The pid of the launcher that ran the command, or -1 with
+ *                  errno set if no launcher is left.
+ */
+pid_t launcher_pool_wait(launcher_pool *p, int *status, int *error);
+
+/**
+ * Make the launchers exit once they are idle and free the pool.
+ *
+ * @param p     The pool to delete.
+ */
+void launcher_pool_del(launcher_pool *p);
+
+#endif
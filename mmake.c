@@ -13,33 +13,131 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <spawn.h>
 #include <time.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include "parser.h"
+#include "statcache.h"
+#include "buildlog.h"
+#include "builtins.h"
+#include "launcher.h"
+#include "eventloop.h"
+#include "capture.h"
 
-#define MAX_LINE 1024
+/* Environment of mmake, which the commands are started with */
+extern char **environ;
+
+/*
+ * The cache belongs to a makefile and is kept next to it. The log is
+ * kept in the working directory, since the names of targets are paths
+ * relative to it.
+ */
+#define CACHE_SUFFIX ".mmake.cache"
+#define LOG_NAME ".mmake_log"
+
+/* Values of the long only options */
+#define OPT_STATS 256
+#define OPT_PREFETCH 257
+#define OPT_HASH 258
+#define OPT_NO_BUILTINS 259
+#define OPT_LAUNCHERS 260
+#define OPT_NO_OUTPUT_SYNC 261
+
+/* State of a node during a run, so that each target is made at most once */
+enum node_state
+{
+	NODE_UNVISITED,
+	NODE_IN_PROGRESS,
+	NODE_QUEUED,
+	NODE_DONE,
+	NODE_FAILED
+};
 
 typedef struct start_args
 {
 	int arg_b;
 	int arg_s;
+	int arg_stats;
+	int arg_prefetch;
+	int arg_hash;
+	int arg_no_builtins;
+	int arg_launchers;
+	int arg_no_output_sync;
+	int sync_output;
+	int merged_output;
 	int n_tar;
 	int c_tar;
 	int exitcode;
+	int cancelled;
+	int jobs;
 	char *makefile;
 	char **target;
+	unsigned char *state;
+	stat_cache *files;
+	uint64_t uncached_calls;
+	uint64_t unchanged;
+	build_log *log;
+	launcher_pool *launchers;
+	event_loop *events;
 } start_args;
 
+/* A target in progress during the walk of the graph */
+typedef struct frame
+{
+	node_id node;
+	uint64_t next;
+} frame;
+
+/* A target whose command is running */
+typedef struct job
+{
+	pid_t pid;
+	node_id node;
+	size_t index;
+	bool ok;
+	int error; /* errno of a launcher that could not start the command */
+	bool logged; /* the log described the target before the command ran */
+	struct timespec start;
+	capture *out; /* output of the command, NULL if not captured */
+} job;
+
 /* ---- Function declaration ---- */
 void *init_struct(void);
 void check_start_args(int argc, char *argv[], start_args *s);
 makefile *choose_makefile(start_args *s);
-void run_makefile(makefile *m, const char *target, start_args *s);
-bool check_file(const char *current, const char *prereq, makefile *m);
-void run_cmd(rule *tar_rule, start_args *s);
+makefile *read_makefile(FILE *file, const char *path);
+char *cache_path(const char *makefile);
+void run_makefile(makefile *m, node_id target, start_args *s);
+node_id *walk_graph(makefile *m, node_id target, start_args *s,
+					size_t *n_order);
+bool visit_node(makefile *m, node_id node, start_args *s);
+void report_cycle(makefile *m, frame *stack, size_t c_stack, node_id prereq);
+void build_targets(makefile *m, const node_id *order, size_t n_order,
+				   start_args *s);
+bool start_target(makefile *m, node_id target, job *j, start_args *s);
+void ready_push(size_t *ready, size_t *c_ready, size_t i);
+size_t ready_pop(size_t *ready, size_t *c_ready);
+bool check_file(node_id current, node_id prereq, makefile *m, start_args *s);
+bool command_changed(makefile *m, node_id target, start_args *s);
+const struct log_entry *hashed_entry(node_id node,
+									 const struct file_status *st,
+									 start_args *s);
+void print_stats(start_args *s);
+void print_cmd(char **exec_cmd);
+pid_t run_cmd(char **exec_cmd, capture *out, start_args *s);
+capture *start_capture(start_args *s);
+void stop_capture(capture *out, start_args *s);
+void finish_job(makefile *m, job *j, start_args *s);
+void log_build(makefile *m, job *j, start_args *s);
+int wait_job(job *jobs, int c_jobs, start_args *s);
+void cancel_jobs(job *jobs, int c_jobs, start_args *s);
+void exit_cancelled(start_args *s);
 void *safe_calloc(size_t size);
 void realloc_buff(char ***buffer, start_args *s);
 
@@ -57,22 +155,80 @@ int main(int argc, char *argv[])
 		fclose(stdout);
 	}
 
+	/*
+	 * Launchers start the commands, one for each job. They are forked
+	 * now, before the makefile is read, since forking is cheap while
+	 * mmake is small.
+	 */
+	if (sa->arg_launchers == 1 &&
+		(sa->launchers = launcher_pool_new(sa->jobs)) == NULL)
+	{
+		perror(strerror(errno));
+		exit(errno);
+	}
+
+	/*
+	 * With several jobs the output of each command is captured and
+	 * printed in one piece when it is done. If standard output and
+	 * standard error are the same file, a command writes both to one
+	 * pipe so that they stay in order.
+	 */
+	struct stat out_st, err_st;
+	sa->sync_output = sa->jobs > 1 && sa->arg_no_output_sync == 0;
+	sa->merged_output = fstat(STDOUT_FILENO, &out_st) == 0 &&
+						fstat(STDERR_FILENO, &err_st) == 0 &&
+						out_st.st_dev == err_st.st_dev &&
+						out_st.st_ino == err_st.st_ino;
+
+	makefile *m = choose_makefile(sa);
+
+	/* Every node starts out unvisited */
+	sa->state = safe_calloc(makefile_nodes(m));
+
+	/* Each file is only stat'd once, unless its command is run */
+	if ((sa->files = stat_cache_new(m)) == NULL)
+	{
+		perror(strerror(errno));
+		exit(errno);
+	}
+
+	/* Targets built are logged for later runs, if the log can be used */
+	sa->log = build_log_open(LOG_NAME, m);
+
 	/* If no targets specified, set target to default target */
 	if (sa->c_tar == 0)
 	{
-		makefile *m = choose_makefile(sa);
-		run_makefile(m, makefile_default_target(m), sa);
+		run_makefile(m, makefile_node(m, makefile_default_target(m)), sa);
 	}
 	else
 	{
 		int i = 0;
-		makefile *m = choose_makefile(sa);
 		while (sa->target[i] != NULL)
 		{
-			run_makefile(m, sa->target[i], sa);
+			run_makefile(m, makefile_node(m, sa->target[i]), sa);
 			i++;
 		}
 	}
+
+	if (sa->arg_stats == 1)
+	{
+		print_stats(sa);
+	}
+
+	if (sa->log != NULL)
+	{
+		build_log_close(sa->log);
+	}
+
+	if (sa->launchers != NULL)
+	{
+		launcher_pool_del(sa->launchers);
+	}
+
+	/*
+	 * The makefile is not deleted with makefile_del() since all
+	 * memory is given back when the process exits anyway.
+	 */
 	exit(sa->exitcode);
 }
 
@@ -92,10 +248,27 @@ void *init_struct(void)
 	/* Initialize values */
 	sa->arg_b = 0;
 	sa->arg_s = 0;
+	sa->arg_stats = 0;
+	sa->arg_prefetch = 0;
+	sa->arg_hash = 0;
+	sa->arg_no_builtins = 0;
+	sa->arg_launchers = 0;
+	sa->arg_no_output_sync = 0;
+	sa->sync_output = 0;
+	sa->merged_output = 0;
 	sa->n_tar = 50;
 	sa->c_tar = 0;
 	sa->exitcode = 0;
+	sa->cancelled = 0;
+	sa->jobs = 1;
 	sa->makefile = NULL;
+	sa->state = NULL;
+	sa->files = NULL;
+	sa->uncached_calls = 0;
+	sa->unchanged = 0;
+	sa->log = NULL;
+	sa->launchers = NULL;
+	sa->events = NULL;
 
 	/* Allocate memory for array where target names will be stored */
 	sa->target = safe_calloc(sizeof(char *) * sa->n_tar);
@@ -104,7 +277,7 @@ void *init_struct(void)
 }
 
 /**
- * @brief Check start arguments given by user with getopt
+ * @brief Check start arguments given by user with getopt_long
  *
  * @param argc  	argc
  * @param argv		argv
@@ -113,8 +286,19 @@ void *init_struct(void)
 void check_start_args(int argc, char *argv[], start_args *s)
 {
 	int flag;
+	char *end;
+	long jobs;
+	static const struct option long_options[] = {
+		{"stats", no_argument, NULL, OPT_STATS},
+		{"prefetch", no_argument, NULL, OPT_PREFETCH},
+		{"hash", no_argument, NULL, OPT_HASH},
+		{"no-builtins", no_argument, NULL, OPT_NO_BUILTINS},
+		{"launchers", no_argument, NULL, OPT_LAUNCHERS},
+		{"no-output-sync", no_argument, NULL, OPT_NO_OUTPUT_SYNC},
+		{NULL, 0, NULL, 0}};
 
-	while ((flag = getopt(argc, argv, ":Bsf:")) != -1)
+	while ((flag = getopt_long(argc, argv, ":Bsf:j:", long_options,
+							   NULL)) != -1)
 	{
 		switch (flag)
 		{
@@ -127,21 +311,54 @@ void check_start_args(int argc, char *argv[], start_args *s)
 		case 's':
 			s->arg_s = 1;
 			break;
+		case 'j':
+			/* Number of commands that may run at the same time */
+			errno = 0;
+			jobs = strtol(optarg, &end, 10);
+			if (errno != 0 || *end != '\0' || jobs < 1 || jobs > 1024)
+			{
+				fprintf(stderr, "mmake: invalid number of jobs '%s'\n",
+						optarg);
+				exit(EXIT_FAILURE);
+			}
+			s->jobs = jobs;
+			break;
+		case OPT_STATS:
+			s->arg_stats = 1;
+			break;
+		case OPT_PREFETCH:
+			s->arg_prefetch = 1;
+			break;
+		case OPT_HASH:
+			s->arg_hash = 1;
+			break;
+		case OPT_NO_BUILTINS:
+			s->arg_no_builtins = 1;
+			break;
+		case OPT_LAUNCHERS:
+			s->arg_launchers = 1;
+			break;
+		case OPT_NO_OUTPUT_SYNC:
+			s->arg_no_output_sync = 1;
+			break;
+		case ':':
 		case '?':
-			fprintf(stderr,
-					"usage: ./mmake [-f MAKEFILE] [-B] [-s] [TARGET]\n");
+			fprintf(stderr, "usage: ./mmake [-f MAKEFILE] [-B] [-s] [-j JOBS] "
+							"[--stats] [--prefetch] [--hash] "
+							"[--no-builtins] [--launchers] "
+							"[--no-output-sync] [TARGET]\n");
 			exit(errno);
 		}
 	}
 
 	for (; optind < argc; optind++)
 	{
-		if (optind > s->n_tar)
+		/* Keep room for the terminating NULL */
+		if (s->c_tar + 1 >= s->n_tar)
 		{
 			realloc_buff(&s->target, s);
 		}
-		s->target[s->c_tar] = safe_calloc(sizeof(char) * MAX_LINE);
-		strcpy(s->target[s->c_tar], argv[optind]);
+		s->target[s->c_tar] = argv[optind];
 		s->c_tar++;
 	}
 }
@@ -171,7 +388,7 @@ makefile *choose_makefile(start_args *s)
 			exit(errno);
 		}
 
-		if ((m = parse_makefile(file)) == NULL)
+		if ((m = read_makefile(file, "mmakefile")) == NULL)
 		{
 			fprintf(stderr, "mmakefile: Could not parse makefile");
 			exit(EXIT_FAILURE);
@@ -189,7 +406,7 @@ makefile *choose_makefile(start_args *s)
 			exit(errno);
 		}
 
-		if ((m = parse_makefile(file)) == NULL)
+		if ((m = read_makefile(file, s->makefile)) == NULL)
 		{
 			fprintf(stderr, "%s: Could not parse makefile", s->makefile);
 			exit(EXIT_FAILURE);
@@ -201,109 +418,605 @@ makefile *choose_makefile(start_args *s)
 }
 
 /**
- * @brief Take parsed makefile and build from it.
+ * @brief Get the parsed makefile from the cache next to it if
+ * the cache was made from the file as it is now, otherwise parse
+ * the file and save it to the cache for the next run.
+ *
+ * @param file		the opened makefile
+ * @param path		path of the makefile
+ * @return m		the makefile, or NULL if it could not be parsed
+ */
+makefile *read_makefile(FILE *file, const char *path)
+{
+	struct stat st;
+	makefile *m;
+
+	if (fstat(fileno(file), &st) < 0 || !S_ISREG(st.st_mode))
+	{
+		return parse_makefile(file);
+	}
+
+	char *cache = cache_path(path);
+	if ((m = makefile_load_cache(cache, &st)) == NULL
+		&& (m = parse_makefile(file)) != NULL)
+	{
+		/* The cache only saves time, so not being able to write it is fine */
+		makefile_save_cache(m, cache, &st);
+	}
+	free(cache);
+
+	return m;
+}
+
+/**
+ * @brief Get the path of the cache for a makefile, which is
+ * kept in the same directory as the makefile and named after it,
+ * .<name>.mmake.cache, so that makefiles side by side do not
+ * replace each other's cache.
+ *
+ * @param makefile	path of the makefile
+ * @return char*	allocated path of the cache
+ */
+char *cache_path(const char *makefile)
+{
+	const char *slash = strrchr(makefile, '/');
+	size_t dir_len = slash != NULL ? (size_t)(slash - makefile) + 1 : 0;
+	size_t name_len = strlen(makefile + dir_len);
+	char *path = safe_calloc(dir_len + 1 + name_len + sizeof(CACHE_SUFFIX));
+
+	memcpy(path, makefile, dir_len);
+	path[dir_len] = '.';
+	memcpy(path + dir_len + 1, makefile + dir_len, name_len);
+	strcpy(path + dir_len + 1 + name_len, CACHE_SUFFIX);
+
+	return path;
+}
+
+/**
+ * @brief Take parsed makefile and build from it. The targets that
+ * need to be made are found first, and then made with up to
+ * s->jobs commands running at the same time.
  *
  * @param m 		the makefile
- * @param target	name of target
+ * @param target	node of target, or NO_NODE
  * @param s			start_args struct
  */
-void run_makefile(makefile *m, const char *target, start_args *s)
+void run_makefile(makefile *m, node_id target, start_args *s)
 {
-	rule *tar_rule;
-	const char **tar_prereq;
+	size_t n_order;
+	node_id *order = walk_graph(m, target, s, &n_order);
+
+	/* Stat all files that will be checked at once, if asked to */
+	if (s->arg_prefetch == 1)
+	{
+		stat_cache_prefetch(s->files, order, n_order);
+	}
 
-	/* Get rule for target, if no rule exist return */
-	if ((tar_rule = makefile_rule(m, target)) == NULL)
+	/*
+	 * Running commands, output of launchers and signals to stop are
+	 * all waited for in one place. The loop only blocks the signals
+	 * while targets are made, so until then they stop mmake at once.
+	 */
+	if ((s->events = event_loop_new()) == NULL ||
+		(s->launchers != NULL &&
+		 event_loop_watch_fd(s->events, launcher_pool_fd(s->launchers),
+							 false) < 0))
+	{
+		perror(strerror(errno));
+		exit(errno);
+	}
+
+	build_targets(m, order, n_order, s);
+	event_loop_del(s->events);
+	s->events = NULL;
+	free(order);
+}
+
+/**
+ * @brief Find the targets that have to be visited to make target.
+ * The graph is walked depth first with an explicit stack, so the
+ * targets come in the order in which they would be made one at a
+ * time: prerequisites in the order they are listed, and before the
+ * target that needs them. If a target depends on itself, the cycle
+ * is reported and mmake exits.
+ *
+ * @param m 		the makefile
+ * @param target	node of target, or NO_NODE
+ * @param s			start_args struct
+ * @param n_order	set to the number of targets found
+ * @return			allocated array of the targets found
+ */
+node_id *walk_graph(makefile *m, node_id target, start_args *s,
+					size_t *n_order)
+{
+	const node_id *edges;
+	const uint64_t *offsets = makefile_graph(m, &edges);
+	size_t n_nodes = makefile_nodes(m);
+	node_id *order = safe_calloc(sizeof(node_id) * (n_nodes + 1));
+
+	*n_order = 0;
+	if (!visit_node(m, target, s))
+	{
+		return order;
+	}
+
+	/*
+	 * Each frame on the stack is a target in progress and the
+	 * position of the next of its prerequisites to visit.
+	 */
+	size_t n_stack = 64;
+	size_t c_stack = 0;
+	frame *stack = safe_calloc(sizeof(frame) * n_stack);
+
+	stack[c_stack++] = (frame){target, offsets[target]};
+	while (c_stack > 0)
+	{
+		frame *top = &stack[c_stack - 1];
+
+		/* All prerequisites visited, so the target comes next */
+		if (top->next == offsets[top->node + 1])
+		{
+			s->state[top->node] = NODE_QUEUED;
+			order[(*n_order)++] = top->node;
+			c_stack--;
+			continue;
+		}
+
+		node_id prereq = edges[top->next++];
+		if (s->state[prereq] == NODE_IN_PROGRESS)
+		{
+			report_cycle(m, stack, c_stack, prereq);
+		}
+
+		if (!visit_node(m, prereq, s))
+		{
+			continue;
+		}
+
+		if (c_stack == n_stack)
+		{
+			n_stack *= 2;
+			if ((stack = realloc(stack, sizeof(frame) * n_stack)) == NULL)
+			{
+				perror("realloc()");
+				exit(errno);
+			}
+		}
+		stack[c_stack++] = (frame){prereq, offsets[prereq]};
+	}
+
+	free(stack);
+	return order;
+}
+
+/**
+ * @brief Start visiting a node. A node is only visited once, and a
+ * node without a rule is done as soon as it is visited.
+ *
+ * @param m 		the makefile
+ * @param node		the node, or NO_NODE
+ * @param s			start_args struct
+ * @return			true if the node has a rule and should be made
+ */
+bool visit_node(makefile *m, node_id node, start_args *s)
+{
+	if (node == NO_NODE || s->state[node] != NODE_UNVISITED)
+	{
+		return false;
+	}
+
+	if (makefile_node_rule(m, node) == NULL)
+	{
+		s->state[node] = NODE_DONE;
+		return false;
+	}
+
+	s->state[node] = NODE_IN_PROGRESS;
+	return true;
+}
+
+/**
+ * @brief Print the cycle that is closed when prereq, which is in
+ * progress, is reached from the target on top of the stack, and exit.
+ *
+ * @param m 		the makefile
+ * @param stack		targets in progress, outermost first
+ * @param c_stack	number of targets in progress
+ * @param prereq	node that is reached again
+ */
+void report_cycle(makefile *m, frame *stack, size_t c_stack, node_id prereq)
+{
+	size_t i = c_stack - 1;
+
+	while (stack[i].node != prereq)
+	{
+		i--;
+	}
+
+	fflush(stdout);
+	fprintf(stderr, "mmake: Circular dependency: ");
+	for (; i < c_stack; i++)
+	{
+		fprintf(stderr, "%s -> ", makefile_node_name(m, stack[i].node));
+	}
+	fprintf(stderr, "%s\n", makefile_node_name(m, prereq));
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Make the targets found by walk_graph(). A target is ready
+ * to be made when all of its prerequisites have been made. Ready
+ * targets are started in the order they were found, with up to
+ * s->jobs commands running at the same time, so with one job the
+ * targets are made in exactly that order.
+ *
+ * @param m 		the makefile
+ * @param order		the targets, with prerequisites before targets
+ * @param n_order	number of targets
+ * @param s			start_args struct
+ */
+void build_targets(makefile *m, const node_id *order, size_t n_order,
+				   start_args *s)
+{
+	const node_id *edges;
+	const uint64_t *offsets = makefile_graph(m, &edges);
+
+	if (n_order == 0)
 	{
 		return;
 	}
 
 	/*
-	 * Check prerequisites and recursively call
-	 * run_makefile() to make them
+	 * Number the targets by their position in order, count the
+	 * prerequisites each of them waits for and collect the targets
+	 * waiting for each of them, indexed like the graph.
 	 */
-	tar_prereq = rule_prereq(tar_rule);
+	node_id *index = safe_calloc(sizeof(node_id) * makefile_nodes(m));
+	size_t *waiting = safe_calloc(sizeof(size_t) * n_order);
+	uint64_t *dep_off = safe_calloc(sizeof(uint64_t) * (n_order + 1));
 
-	int i = 0;
-	int j = 0;
-	if (tar_prereq != NULL)
+	for (size_t i = 0; i < n_order; i++)
+	{
+		index[order[i]] = i;
+	}
+
+	for (size_t i = 0; i < n_order; i++)
 	{
-		while (tar_prereq[i] != NULL)
+		for (uint64_t e = offsets[order[i]]; e < offsets[order[i] + 1]; e++)
 		{
-			run_makefile(m, tar_prereq[i], s);
-			i++;
+			if (s->state[edges[e]] == NODE_QUEUED)
+			{
+				waiting[i]++;
+				dep_off[index[edges[e]] + 1]++;
+			}
 		}
+	}
+
+	for (size_t i = 0; i < n_order; i++)
+	{
+		dep_off[i + 1] += dep_off[i];
+	}
 
-		/* If option -B used, skip file check to force build */
-		if (s->arg_b == 1)
+	size_t *deps = safe_calloc(sizeof(size_t) * (dep_off[n_order] + 1));
+	uint64_t *next_dep = safe_calloc(sizeof(uint64_t) * n_order);
+
+	memcpy(next_dep, dep_off, sizeof(uint64_t) * n_order);
+	for (size_t i = 0; i < n_order; i++)
+	{
+		for (uint64_t e = offsets[order[i]]; e < offsets[order[i] + 1]; e++)
+		{
+			if (s->state[edges[e]] == NODE_QUEUED)
+			{
+				deps[next_dep[index[edges[e]]]++] = i;
+			}
+		}
+	}
+	free(next_dep);
+
+	/* Targets ready to be made, as a heap on their position in order */
+	size_t *ready = safe_calloc(sizeof(size_t) * n_order);
+	size_t c_ready = 0;
+	job *jobs = safe_calloc(sizeof(job) * s->jobs);
+	int c_jobs = 0;
+
+	for (size_t i = 0; i < n_order; i++)
+	{
+		if (waiting[i] == 0)
 		{
-			run_cmd(tar_rule, s);
+			ready_push(ready, &c_ready, i);
+		}
+	}
+
+	while ((c_ready > 0 && s->cancelled == 0) || c_jobs > 0)
+	{
+		size_t done;
+
+		if (c_ready > 0 && c_jobs < s->jobs && s->cancelled == 0)
+		{
+			/* Notice a signal to stop even when no command is running */
+			if ((s->cancelled = event_loop_poll_signal(s->events)) != 0)
+			{
+				cancel_jobs(jobs, c_jobs, s);
+				continue;
+			}
+
+			done = ready_pop(ready, &c_ready);
+			if (start_target(m, order[done], &jobs[c_jobs], s))
+			{
+				jobs[c_jobs++].index = done;
+				continue;
+			}
 		}
 		else
 		{
-			while (tar_prereq[j] != NULL)
+			int j = wait_job(jobs, c_jobs, s);
+			job *finished = &jobs[j];
+
+			finish_job(m, finished, s);
+			done = finished->index;
+			jobs[j] = jobs[--c_jobs];
+		}
+
+		/* Targets waiting for the one that is done may now be ready */
+		for (uint64_t d = dep_off[done]; d < dep_off[done + 1]; d++)
+		{
+			if (--waiting[deps[d]] == 0)
 			{
-				if (check_file(target, tar_prereq[j], m))
-				{
-					run_cmd(tar_rule, s);
-				}
-				j++;
+				ready_push(ready, &c_ready, deps[d]);
+			}
+		}
+	}
+
+	free(jobs);
+	free(ready);
+	free(deps);
+	free(dep_off);
+	free(waiting);
+	free(index);
+
+	if (s->cancelled != 0)
+	{
+		exit_cancelled(s);
+	}
+}
+
+/**
+ * @brief Start to make a target whose prerequisites have all been
+ * made. The target is not made if one of its prerequisites failed.
+ * Otherwise its command is run once if any prerequisite is newer
+ * than the target, or if option -B is used.
+ *
+ * @param m 		the makefile
+ * @param target	node of target
+ * @param j			job to fill in if a command is started
+ * @param s			start_args struct
+ * @return			true if a command was started
+ */
+bool start_target(makefile *m, node_id target, job *j, start_args *s)
+{
+	const node_id *edges;
+	const uint64_t *offsets = makefile_graph(m, &edges);
+	bool dirty = s->arg_b == 1;
+	char **cmd;
+	int status;
+	int err;
+
+	for (uint64_t i = offsets[target]; i < offsets[target + 1]; i++)
+	{
+		if (s->state[edges[i]] == NODE_FAILED)
+		{
+			s->state[target] = NODE_FAILED;
+			return false;
+		}
+	}
+
+	/*
+	 * If option -B used, skip file check to force build. Otherwise
+	 * every prerequisite is checked, even after one newer than the
+	 * target has been found, so that missing files are reported.
+	 */
+	if (s->arg_b != 1)
+	{
+		for (uint64_t i = offsets[target]; i < offsets[target + 1]; i++)
+		{
+			if (check_file(target, edges[i], m, s))
+			{
+				dirty = true;
 			}
 		}
 	}
+
+	/* A target built by another command than its current one is old */
+	if (!dirty && s->log != NULL)
+	{
+		dirty = command_changed(m, target, s);
+	}
+
+	if (!dirty)
+	{
+		s->state[target] = NODE_DONE;
+		return false;
+	}
+
+	j->node = target;
+	j->ok = true;
+	j->logged = hashed_entry(target, stat_cache_get(s->files, target), s)
+				!= NULL;
+	j->error = 0;
+	j->out = NULL;
+	cmd = rule_cmd(makefile_node_rule(m, target));
+	clock_gettime(CLOCK_MONOTONIC, &j->start);
+
+	/*
+	 * Trivial commands are run by mmake itself, without a process.
+	 * They print nothing, so the command can be printed after it.
+	 */
+	if (s->arg_no_builtins == 0 && (status = builtin_run(cmd)) != -1)
+	{
+		print_cmd(cmd);
+		if (status != 0)
+		{
+			s->exitcode = status;
+			j->ok = false;
+		}
+		finish_job(m, j, s);
+		return false;
+	}
+
+	/*
+	 * A command whose output is captured is printed with its output
+	 * once it is done, otherwise it is printed now.
+	 */
+	if (s->sync_output == 1)
+	{
+		j->out = start_capture(s);
+	}
+	if (j->out == NULL)
+	{
+		print_cmd(cmd);
+	}
+
+	if (s->launchers != NULL)
+	{
+		j->pid = launcher_pool_run(s->launchers, cmd,
+								   j->out ? capture_child_fd(j->out, 1) : -1,
+								   j->out ? capture_child_fd(j->out, 2) : -1);
+	}
 	else
 	{
-		run_cmd(tar_rule, s);
+		j->pid = run_cmd(cmd, j->out, s);
+	}
+	if (j->out != NULL)
+	{
+		capture_started(j->out);
+	}
+	if (j->pid == -1)
+	{
+		/*
+		 * Fail the target like a command that exits with errno, the
+		 * same as when a launcher could not start it
+		 */
+		err = errno;
+		if (j->out != NULL)
+		{
+			print_cmd(cmd);
+			stop_capture(j->out, s);
+		}
+		errno = err;
+		perror(strerror(err));
+		s->exitcode = err;
+		s->state[target] = NODE_FAILED;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Add a target to the heap of ready targets.
+ *
+ * @param ready		the heap
+ * @param c_ready	number of targets in the heap
+ * @param i			position of the target in order
+ */
+void ready_push(size_t *ready, size_t *c_ready, size_t i)
+{
+	size_t k = (*c_ready)++;
+
+	while (k > 0 && ready[(k - 1) / 2] > i)
+	{
+		ready[k] = ready[(k - 1) / 2];
+		k = (k - 1) / 2;
 	}
+	ready[k] = i;
+}
+
+/**
+ * @brief Remove the first target in order from the heap of ready
+ * targets.
+ *
+ * @param ready		the heap
+ * @param c_ready	number of targets in the heap
+ * @return			position of the target in order
+ */
+size_t ready_pop(size_t *ready, size_t *c_ready)
+{
+	size_t first = ready[0];
+	size_t last = ready[--(*c_ready)];
+	size_t k = 0;
+
+	for (;;)
+	{
+		size_t child = 2 * k + 1;
+		if (child >= *c_ready)
+		{
+			break;
+		}
+		if (child + 1 < *c_ready && ready[child + 1] < ready[child])
+		{
+			child++;
+		}
+		if (last <= ready[child])
+		{
+			break;
+		}
+		ready[k] = ready[child];
+		k = child;
+	}
+	ready[k] = last;
+
+	return first;
 }
 
 /**
  * @brief Check if files exist or needs to be created, if files exist
  * compare to see if prerequisite file was modified more recently than the
  * target. If there is no rule to make prerequisite, give error and exit.
+ * The status of the files is taken from the stat cache. With --hash the
+ * time the contents of the prerequisite last changed is used instead of
+ * its modification time.
  *
- * @param current	name of current target
- * @param prereq	name of prerequisite
+ * @param current	node of current target
+ * @param prereq	node of prerequisite
  * @param m			the makefile
+ * @param s			start_args struct
  * @return      	true or false
  */
-bool check_file(const char *current, const char *prereq, makefile *m)
+bool check_file(node_id current, node_id prereq, makefile *m, start_args *s)
 {
+	const struct file_status *stat_pre = stat_cache_get(s->files, prereq);
+	const struct file_status *stat_tar;
+	const struct log_entry *built;
+
 	/*
-	 * Create structs for stat() func and variables for
-	 * time value when files were edited
+	 * Without the cache this check made an access() call for each
+	 * file that was looked at, and an lstat() call for each file
+	 * if both existed. Count them for --stats.
 	 */
-	struct stat stat_tar;
-	struct stat stat_pre;
-	time_t time_tar;
-	time_t time_pre;
+	s->uncached_calls++;
 
 	/* Check if files exist, return true if a file needs to be created */
-	if (access(prereq, F_OK) < 0)
+	if (!stat_pre->exists)
 	{
-		if (makefile_rule(m, prereq) == NULL)
+		if (makefile_node_rule(m, prereq) == NULL)
 		{
-			fprintf(stderr, "mmake: No rule to make target '%s'\n", prereq);
+			fprintf(stderr, "mmake: No rule to make target '%s'\n",
+					makefile_node_name(m, prereq));
 			exit(EXIT_FAILURE);
 		}
 		return true;
 	}
 
-	if (access(current, F_OK) < 0)
+	stat_tar = stat_cache_get(s->files, current);
+	s->uncached_calls++;
+	if (!stat_tar->exists)
 	{
 		return true;
 	}
+	s->uncached_calls += 2;
 
-	/* Collect information about files */
-	lstat(prereq, &stat_pre);
-	lstat(current, &stat_tar);
-
-	/* Save time for last modification of files in time variables */
-	time_tar = stat_tar.st_mtime;
-	time_pre = stat_pre.st_mtime;
-
-	/* Compare if prerequisite was modified after target */
-	if (difftime(time_pre, time_tar) < 0 || difftime(time_pre, time_tar) == 0)
+	/* Compare if prerequisite was modified after target, to the nanosecond */
+	built = hashed_entry(prereq, stat_pre, s);
+	if ((built != NULL ? built->changed : stat_pre->mtime) <= stat_tar->mtime)
 	{
 		return false;
 	}
@@ -314,19 +1027,15 @@ bool check_file(const char *current, const char *prereq, makefile *m)
 }
 
 /**
- * @brief Execute the command for given rule
+ * @brief Print a command before it is run. The output is flushed so
+ * that it comes before anything the command writes.
  *
- * @param tar_rule	rule for target to be made
- * @param s			start_args struct
+ * @param exec_cmd	the command, terminated by NULL
  */
-void run_cmd(rule *tar_rule, start_args *s)
+void print_cmd(char **exec_cmd)
 {
-	pid_t pid;
 	int i = 0;
-	int status;
 
-	/* Get command for the rule and print it */
-	char **exec_cmd = rule_cmd(tar_rule);
 	while (exec_cmd[i] != NULL)
 	{
 		if (exec_cmd[i + 1] == NULL)
@@ -339,36 +1048,429 @@ void run_cmd(rule *tar_rule, start_args *s)
 		}
 		i++;
 	}
-
-	/* Fork to execute command */
 	fflush(stdout);
-	switch (pid = fork())
+}
+
+/**
+ * @brief Start a command and watch it in the event loop. The command
+ * is started with posix_spawnp(), which does not copy the memory of
+ * mmake like fork() does, so starting a command takes the same time
+ * however large the makefile is.
+ *
+ * @param exec_cmd	the command, terminated by NULL
+ * @param out		capture of the output of the command, or NULL for
+ * 					it to write to the output of mmake
+ * @param s			start_args struct
+ * @return			pid of the command, or -1 with errno set if it
+ * 					could not be started
+ */
+pid_t run_cmd(char **exec_cmd, capture *out, start_args *s)
+{
+	pid_t pid;
+	int err;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+
+	/* A captured command writes to the pipes of its capture */
+	posix_spawn_file_actions_init(&actions);
+	if (out != NULL)
+	{
+		posix_spawn_file_actions_adddup2(&actions, capture_child_fd(out, 1),
+										 STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, capture_child_fd(out, 2),
+										 STDERR_FILENO);
+	}
+
+	/* The command gets the signals mmake has blocked for the event loop */
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+	posix_spawnattr_setsigmask(&attr, event_loop_sigmask(s->events));
+
+	/* Start the command, which shares the memory of mmake until exec */
+	err = posix_spawnp(&pid, exec_cmd[0], &actions, &attr, exec_cmd, environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	if (err != 0)
+	{
+		errno = err;
+		return -1;
+	}
+
+	if (event_loop_watch_child(s->events, pid) < 0)
 	{
-	case -1:
-		/* If fork failes, print error and exit */
 		perror(strerror(errno));
 		exit(errno);
-	case 0: /* Child */
-		/* Execute given command, if execvp fail print error and exit */
-		if (execvp(exec_cmd[0], exec_cmd) < 0)
+	}
+
+	return pid;
+}
+
+/**
+ * @brief Create a capture for the output of a command and watch its
+ * pipes, so that they are emptied whenever they can be read and the
+ * command never blocks on them.
+ *
+ * @param s			start_args struct
+ * @return			the capture, or NULL if the output of the command
+ * 					cannot be captured
+ */
+capture *start_capture(start_args *s)
+{
+	capture *out = capture_new(s->merged_output == 1);
+	int fd;
+
+	if (out == NULL)
+	{
+		return NULL;
+	}
+
+	for (int stream = 1; stream <= 2; stream++)
+	{
+		fd = capture_watch_fd(out, stream);
+		if (fd >= 0 && event_loop_watch_fd(s->events, fd, false) < 0)
 		{
-			perror(strerror(errno));
-			exit(errno);
+			stop_capture(out, s);
+			return NULL;
+		}
+	}
+
+	return out;
+}
+
+/**
+ * @brief Stop watching the pipes of a capture and delete it.
+ *
+ * @param out		the capture
+ * @param s			start_args struct
+ */
+void stop_capture(capture *out, start_args *s)
+{
+	int fd;
+
+	for (int stream = 1; stream <= 2; stream++)
+	{
+		if ((fd = capture_watch_fd(out, stream)) >= 0)
+		{
+			event_loop_unwatch_fd(s->events, fd);
+		}
+	}
+	capture_del(out);
+}
+
+/**
+ * @brief Mark the target of a job that is done as made or failed,
+ * and record it in the build log if it was made. If the output of
+ * its command was captured, the command and its output are printed.
+ *
+ * @param m 		the makefile
+ * @param j			the job
+ * @param s			start_args struct
+ */
+void finish_job(makefile *m, job *j, start_args *s)
+{
+	if (j->out != NULL)
+	{
+		print_cmd(rule_cmd(makefile_node_rule(m, j->node)));
+		capture_flush(j->out, s->arg_s == 1 ? -1 : STDOUT_FILENO,
+					  STDERR_FILENO);
+		stop_capture(j->out, s);
+		j->out = NULL;
+	}
+
+	/* Reported after the command, so that it is clear which one failed */
+	if (j->error != 0)
+	{
+		errno = j->error;
+		perror(strerror(errno));
+	}
+
+	/* The command may have changed the file of the target */
+	stat_cache_invalidate(s->files, j->node);
+	if (j->ok)
+	{
+		log_build(m, j, s);
+	}
+	s->state[j->node] = j->ok ? NODE_DONE : NODE_FAILED;
+}
+
+/**
+ * @brief Record in the build log that the command of a job has
+ * built its target. With --hash the contents of the target are
+ * hashed too, unless the file is the same as when it was last
+ * hashed, and if they are the same as before the time they last
+ * changed is kept, so that targets depending on it are not rebuilt.
+ *
+ * @param m 		the makefile
+ * @param j			the job
+ * @param s			start_args struct
+ */
+void log_build(makefile *m, job *j, start_args *s)
+{
+	struct timespec end;
+	struct log_entry e;
+
+	if (s->log == NULL)
+	{
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	const struct file_status *st = stat_cache_get(s->files, j->node);
+
+	e.mtime = st->exists ? st->mtime : 0;
+	e.cmd_hash = build_log_hash_cmd(rule_cmd(makefile_node_rule(m, j->node)));
+	e.duration = timestamp_from_timespec(end) - timestamp_from_timespec(j->start);
+	e.content_hash = 0;
+	e.changed = e.mtime;
+	e.ino = st->ino;
+	e.size = st->size;
+
+	if (s->arg_hash == 1 && st->exists)
+	{
+		const struct log_entry *prev = build_log_get(s->log, j->node);
+
+		if (prev != NULL && prev->content_hash != 0 && prev->mtime == st->mtime
+			&& prev->ino == st->ino && prev->size == st->size)
+		{
+			/* The command did not write the file, so the hash still holds */
+			e.content_hash = prev->content_hash;
 		}
-		break;
-	default: /* Parent */
-		/* Wait for child process to exit and save exit code */
-		if (waitpid(pid, &status, 0) == -1)
+		else if (build_log_hash_file(makefile_node_name(m, j->node),
+									 &e.content_hash) < 0)
+		{
+			e.content_hash = 0;
+		}
+
+		/* Contents changed by hand since the last build count as changed */
+		if (e.content_hash != 0 && j->logged
+			&& prev->content_hash == e.content_hash)
+		{
+			e.changed = prev->changed;
+			s->unchanged++;
+		}
+	}
+
+	/* The log only saves work, so not being able to write it is fine */
+	build_log_record(s->log, j->node, &e);
+}
+
+/**
+ * @brief Wait for one of the running jobs to finish. If its
+ * command failed, the job is marked as failed and the exit code
+ * is saved. With launchers, the pid of a job is the pid of the
+ * launcher running its command. A signal telling mmake to stop
+ * that comes while waiting is passed on to the running jobs, and
+ * captured output is collected from pipes that can be read.
+ *
+ * @param jobs		the running jobs
+ * @param c_jobs	number of running jobs
+ * @param s			start_args struct
+ * @return			index of the job that finished
+ */
+int wait_job(job *jobs, int c_jobs, start_args *s)
+{
+	pid_t pid = -1;
+	int status;
+	int error = 0;
+	struct event ev;
+
+	for (;;)
+	{
+		/* Wait for any command to exit, or for its launcher to report it */
+		if (event_loop_wait(s->events, &ev) < 0)
 		{
 			perror(strerror(errno));
 			exit(errno);
 		}
 
-		if (WIFEXITED(status))
+		switch (ev.kind)
 		{
-			s->exitcode = WEXITSTATUS(status);
+		case EVENT_SIGNAL:
+			/* Stop starting commands and stop those running */
+			s->cancelled = ev.signo;
+			cancel_jobs(jobs, c_jobs, s);
+			continue;
+		case EVENT_CHILD:
+			pid = ev.pid;
+			status = ev.status;
+			break;
+		case EVENT_FD:
+			if (s->launchers == NULL ||
+				ev.fd != launcher_pool_fd(s->launchers))
+			{
+				/* Keep a command from blocking on a full pipe */
+				for (int j = 0; j < c_jobs; j++)
+				{
+					if (jobs[j].out != NULL &&
+						capture_collect(jobs[j].out, ev.fd))
+					{
+						break;
+					}
+				}
+				continue;
+			}
+			if ((pid = launcher_pool_wait(s->launchers, &status,
+										  &error)) == -1)
+			{
+				perror(strerror(errno));
+				exit(errno);
+			}
+			break;
 		}
-		break;
+
+		for (int j = 0; j < c_jobs; j++)
+		{
+			if (jobs[j].pid != pid)
+			{
+				continue;
+			}
+
+			if (error != 0)
+			{
+				/* The launcher could not start the command */
+				s->exitcode = error;
+				jobs[j].error = error;
+				jobs[j].ok = false;
+			}
+			else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			{
+				/* Remember the failure so that mmake exits with it */
+				s->exitcode = WIFEXITED(status) ? WEXITSTATUS(status)
+												: EXIT_FAILURE;
+				jobs[j].ok = false;
+			}
+			return j;
+		}
+	}
+}
+
+/**
+ * @brief Pass the signal that told mmake to stop on to the commands
+ * of the running jobs.
+ *
+ * @param jobs		the running jobs
+ * @param c_jobs	number of running jobs
+ * @param s			start_args struct
+ */
+void cancel_jobs(job *jobs, int c_jobs, start_args *s)
+{
+	for (int j = 0; j < c_jobs; j++)
+	{
+		kill(jobs[j].pid, s->cancelled);
+	}
+}
+
+/**
+ * @brief Exit because of the signal that told mmake to stop, once
+ * the running jobs have ended. The signal is raised again so that
+ * mmake ends the way it would have without the event loop.
+ *
+ * @param s			start_args struct
+ */
+void exit_cancelled(start_args *s)
+{
+	/* What has been built so far is kept in the log */
+	if (s->log != NULL)
+	{
+		build_log_close(s->log);
+	}
+
+	signal(s->cancelled, SIG_DFL);
+	raise(s->cancelled);
+	event_loop_del(s->events);
+
+	/* Only reached if the signal does not end the process */
+	exit(128 + s->cancelled);
+}
+
+/**
+ * @brief Check if the command of a target has changed since the
+ * target was last built, according to the build log. A target that
+ * is up to date but missing from the log is added to it with its
+ * current command, so that later changes to the command are seen.
+ *
+ * @param m 		the makefile
+ * @param target	node of target
+ * @param s			start_args struct
+ * @return			true if the target was built by another command
+ */
+bool command_changed(makefile *m, node_id target, start_args *s)
+{
+	const struct log_entry *built = build_log_get(s->log, target);
+	uint64_t hash = build_log_hash_cmd(rule_cmd(makefile_node_rule(m, target)));
+
+	if (built != NULL)
+	{
+		return built->cmd_hash != hash;
+	}
+
+	const struct file_status *st = stat_cache_get(s->files, target);
+	if (st->exists)
+	{
+		struct log_entry e = {.mtime = st->mtime,
+							  .cmd_hash = hash,
+							  .changed = st->mtime,
+							  .ino = st->ino,
+							  .size = st->size};
+		build_log_record(s->log, target, &e);
+	}
+
+	return false;
+}
+
+/**
+ * @brief With --hash, get the entry of the build log which has the
+ * hash of the contents of a file, if the file is the same as when
+ * its target was last built. The time its contents last changed is
+ * then the time recorded in the entry, not the modification time.
+ *
+ * @param node		node of the file
+ * @param st		status of the file
+ * @param s			start_args struct
+ * @return			the entry, or NULL if it does not describe the file
+ */
+const struct log_entry *hashed_entry(node_id node,
+									 const struct file_status *st,
+									 start_args *s)
+{
+	const struct log_entry *built;
+
+	if (s->arg_hash == 0 || s->log == NULL || !st->exists)
+	{
+		return NULL;
+	}
+
+	built = build_log_get(s->log, node);
+	if (built == NULL || built->content_hash == 0 || built->mtime != st->mtime
+		|| built->ino != st->ino || built->size != st->size)
+	{
+		return NULL;
+	}
+
+	return built;
+}
+
+/**
+ * @brief Print how many system calls the stat cache saved, and with
+ * --hash how many targets were rebuilt with the same contents.
+ *
+ * @param s			start_args struct
+ */
+void print_stats(start_args *s)
+{
+	uint64_t lookups;
+	uint64_t calls;
+
+	stat_cache_counts(s->files, &lookups, &calls);
+	fprintf(stderr,
+			"mmake: %" PRIu64 " file lookups, %" PRIu64 " stat calls, "
+			"%" PRIu64 " system calls saved\n",
+			lookups, calls,
+			s->uncached_calls > calls ? s->uncached_calls - calls : 0);
+	if (s->arg_hash == 1)
+	{
+		fprintf(stderr, "mmake: %" PRIu64 " targets rebuilt unchanged\n",
+				s->unchanged);
 	}
 }
 
@@ -392,7 +1494,8 @@ void *safe_calloc(size_t size)
 }
 
 /**
- * @brief Reallocate **char buffer.
+ * @brief Double the size of the target buffer. The new
+ * entries are set to NULL.
  *
  * @param buffer  	Pointer to **char buffer.
  * @param s			start_args struct.
@@ -400,6 +1503,7 @@ void *safe_calloc(size_t size)
 void realloc_buff(char ***buffer, start_args *s)
 {
 	char **temp;
+	int old_n = s->n_tar;
 
 	s->n_tar *= 2;
 
@@ -411,18 +1515,5 @@ void realloc_buff(char ***buffer, start_args *s)
 	}
 	*buffer = temp;
 
-	for (int i = 0; i < s->n_tar; i++)
-	{
-		char *temp2;
-		temp2 = realloc(*buffer[i], sizeof(char) * MAX_LINE);
-		if (temp2 == NULL)
-		{
-			perror("realloc()");
-			exit(errno);
-		}
-		else
-		{
-			*buffer[i] = temp2;
-		}
-	}
+	memset(*buffer + old_n, 0, sizeof(char *) * (s->n_tar - old_n));
 }
@@ -7,90 +7,511 @@
  * @author Elias Åström, Fredrik Peteri
  * @date 2020-09-04
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
-#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "parser.h"
+#include "util.h"
 
-#define MAX_RULES 256
-#define MAX_LINE 1024
-#define MAX_PREREQ 32
-#define MAX_CMD 32
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
+#define ARENA_CHUNK (64 * 1024)
+#define VEC_MIN 64
+#define SYMBOLS_MIN 64
+#define PARALLEL_MIN (4 * 1024 * 1024)
+#define MAX_THREADS 16
+#define CACHE_MAGIC "mmake\0\0\1"
+
+/**
+ * Bump allocator.  Memory is handed out from large chunks which are only
+ * released all at once by arena_free.  Each chunk is twice the size of the
+ * previous one, so a makefile of any size needs only a handful of chunks.
+ */
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+struct arena {
+	struct arena_chunk *head;
+};
+
+/**
+ * An interned name.  Every distinct target or prerequisite in a makefile is
+ * stored once, and its node id is its index in the symbol table.  Symbols
+ * hold no pointers so that a table can be saved to and used from a cache.
+ */
+struct symbol {
+	uint64_t name;		// offset of the NUL-terminated name in strs
+	uint64_t hash;
+	uint32_t len;		// length of the name
+	uint32_t has_rule;	// the node is the target of a rule
+};
+
+/**
+ * A makefile is a graph over its nodes.  The prerequisites and the command of
+ * each node are stored in compressed sparse row form: the prerequisites of
+ * node i are prereq[prereq_off[i]] up to prereq[prereq_off[i + 1]], and the
+ * same goes for cmd and cmd_off.  Nodes that are not the target of a rule have
+ * empty rows.  If several rules have the same target, the first one is used.
+ */
 struct makefile {
-	struct rule *rules;
+	struct arena arena;	// owns the graph and the arrays built for rules
+	char *text;		// the makefile text or the mapped cache
+	size_t text_size;	// length of the text, or size of the mapping
+	bool text_mapped;	// text is mapped from a file rather than read
+	bool cached;		// the tables below point into a mapped cache
+	const char *strs;	// base of the offsets of names and arguments
+	struct symbol *syms;	// symbol table indexed by node id
+	size_t n_syms;
+	size_t syms_cap;
+	node_id *index;		// open-addressing hash table of node id + 1
+	size_t index_mask;	// number of slots in index minus one
+	uint64_t *prereq_off;
+	node_id *prereq;
+	uint64_t *cmd_off;
+	uint64_t *cmd;		// offsets of the arguments in strs
+	node_id default_node;
+	struct rule *rules;	// indexed by node id, filled in on first use
 };
 
 struct rule {
-	char *target;
-	char **prereq;
-	char **cmd;
-	rule *next;
+	makefile *make;
+	node_id target;
+	const char **prereq_names; // built from the graph on first use
+	char **cmd;		// likewise
 };
 
 /**
- * Check if line is blank.
+ * Layout of a cache file.  The header is followed by the symbol table, the
+ * index and the rows of the graph, each starting on an 8 byte boundary, and
+ * finally the names and arguments.  The identity of the makefile the cache
+ * was made from is recorded so that a stale cache is never used.
  */
-static bool is_blank_line(const char *s)
+struct cache_header {
+	char magic[8];
+	uint64_t byte_order;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t ctime_sec;
+	int64_t ctime_nsec;
+	uint64_t n_syms;
+	uint64_t index_cap;
+	uint64_t n_prereq;
+	uint64_t n_cmd;
+	uint64_t strs_size;
+	uint64_t default_node;
+};
+
+/**
+ * Allocate n bytes aligned to align, which must be a power of two, from a.
+ * Returns NULL if memory could not be allocated.
+ */
+static void *arena_alloc(struct arena *a, size_t n, size_t align)
 {
-	for (size_t i = 0; s[i] != '\0'; i++) {
-		if (!isspace(s[i]))
-			return false;
+	struct arena_chunk *c = a->head;
+
+	if (c != NULL) {
+		size_t off = (c->used + align - 1) & ~(align - 1);
+		if (off + n <= c->size) {
+			c->used = off + n;
+			return (char *)c->data + off;
+		}
 	}
+
+	size_t size = c != NULL ? 2 * c->size : ARENA_CHUNK;
+	while (size < n)
+		size *= 2;
+
+	if ((c = malloc(sizeof *c + size)) == NULL)
+		return NULL;
+	c->next = a->head;
+	c->size = size;
+	c->used = n;
+	a->head = c;
+
+	return c->data;
+}
+
+/**
+ * Allocate an array of n elements of type T from arena a.
+ */
+#define ARENA_ARRAY(a, T, n) ((T *)arena_alloc((a), (n) * sizeof(T), _Alignof(T)))
+
+/**
+ * Release all memory allocated from a.
+ */
+static void arena_free(struct arena *a)
+{
+	struct arena_chunk *c = a->head;
+	while (c != NULL) {
+		struct arena_chunk *next = c->next;
+		free(c);
+		c = next;
+	}
+	a->head = NULL;
+}
+
+/**
+ * Find the slot in the index of m for the name of length n, which is either
+ * the slot holding its node or the empty slot where it should be inserted.
+ */
+static size_t index_slot(makefile *m, const char *name, size_t n, uint64_t h)
+{
+	size_t i = h & m->index_mask;
+	for (; m->index[i] != 0; i = (i + 1) & m->index_mask) {
+		struct symbol *sym = &m->syms[m->index[i] - 1];
+		if (sym->hash == h && sym->len == n
+				&& memcmp(m->strs + sym->name, name, n) == 0)
+			break;
+	}
+	return i;
+}
+
+/**
+ * Double the size of the index of m.  Returns false if memory could not be
+ * allocated.
+ */
+static bool grow_index(makefile *m)
+{
+	size_t cap = m->index != NULL ? 2 * (m->index_mask + 1) : 2 * SYMBOLS_MIN;
+	node_id *index = calloc(cap, sizeof *index);
+	if (index == NULL)
+		return false;
+
+	free(m->index);
+	m->index = index;
+	m->index_mask = cap - 1;
+
+	for (size_t id = 0; id < m->n_syms; id++) {
+		size_t i = m->syms[id].hash & m->index_mask;
+		while (m->index[i] != 0)
+			i = (i + 1) & m->index_mask;
+		m->index[i] = id + 1;
+	}
+
 	return true;
 }
 
 /**
- * Parse a word and update p to point to the first character after the word.
- * The word is delimited by whitespace and any character in delim.  The
- * returned string should be freed using free.
+ * Get the node for a name of length n with hash h in the text of m, adding it
+ * to the symbol table if it is not there already.
+ *
+ * @return      The node, or NO_NODE if memory could not be allocated.
  */
-static char *parse_word(char **p, char *delim)
+static node_id intern(makefile *m, const char *name, size_t n, uint64_t h)
 {
-	size_t n = 0;
-	while (!isspace((*p)[n]) && strchr(delim, (*p)[n]) == NULL)
-		n++;
+	size_t i = index_slot(m, name, n, h);
+	if (m->index[i] != 0)
+		return m->index[i] - 1;
 
-	if (n == 0)
-		return NULL;
+	// keep the index at most half full
+	if (2 * (m->n_syms + 1) > m->index_mask + 1) {
+		if (!grow_index(m))
+			return NO_NODE;
+		i = index_slot(m, name, n, h);
+	}
 
-	char *path = strndup(*p, n);
-	*p += n;
-	return path;
+	if (m->n_syms == m->syms_cap) {
+		size_t cap = m->syms_cap != 0 ? 2 * m->syms_cap : SYMBOLS_MIN;
+		struct symbol *syms = realloc(m->syms, cap * sizeof *syms);
+		if (syms == NULL)
+			return NO_NODE;
+		m->syms = syms;
+		m->syms_cap = cap;
+	}
+
+	node_id id = m->n_syms++;
+	m->syms[id] = (struct symbol){ name - m->strs, h, n, false };
+	m->index[i] = id + 1;
+	return id;
 }
 
 /**
- * Fills buf with the next line from fp.  Returns buf if a line was read and
- * NULL otherwise.
+ * A word in the makefile text, given by its first character and length.  The
+ * hash is only computed for names.
+ */
+struct slice {
+	char *s;
+	size_t n;
+	uint64_t hash;
+};
+
+/**
+ * Growable array.  Arrays grow by doubling, so appending is amortised constant
+ * time and a whole parse only reallocates a logarithmic number of times no
+ * matter how many words its rules have.
  */
-static char *next_line(char buf[MAX_LINE], FILE *fp)
+struct vec {
+	void *v;
+	size_t n;
+	size_t cap;
+};
+
+/**
+ * Append k elements of the given size to v and return a pointer to the first
+ * of them.  Returns NULL if memory could not be allocated.
+ */
+static void *vec_push(struct vec *v, size_t size, size_t k)
 {
-	do {
-		if (fgets(buf, MAX_LINE, fp) == NULL)
+	// allocate even when k is 0, since NULL means failure
+	if (v->n + k > v->cap || v->v == NULL) {
+		size_t cap = v->cap != 0 ? v->cap : VEC_MIN;
+		while (cap < v->n + k)
+			cap *= 2;
+
+		void *t = realloc(v->v, cap * size);
+		if (t == NULL)
 			return NULL;
-	} while (is_blank_line(buf));
+		v->v = t;
+		v->cap = cap;
+	}
 
-	return buf;
+	void *p = (char *)v->v + v->n * size;
+	v->n += k;
+	return p;
 }
 
 /**
- * Duplicate an array of strings.
- *
- * @param n     Size of array to duplicate.
- * @param a     Array to duplicate.
- * @return      NULL-terminated array which should be freed using free.
+ * A rule as it is parsed.  Its prerequisites and arguments are the elements
+ * of the prereq and cmd arrays of the parse from the indices given here up to
+ * those of the next rule.
  */
-static char **dupe_str_array(size_t n, char **a)
+struct parsed_rule {
+	node_id target;
+	size_t prereq;
+	size_t cmd;
+};
+
+/**
+ * State of a parse.  Rules are collected in the order they appear in the text
+ * and turned into the graph of the makefile once all of them are parsed.
+ */
+struct parse {
+	makefile *m;
+	struct vec rules;	// struct parsed_rule
+	struct vec prereq;	// node_id
+	struct vec cmd;		// uint64_t offsets of arguments in the text
+};
+
+/**
+ * Rules tokenized from a part of the text but not yet added to a parse.  This
+ * is the part of parsing which does not touch the makefile and only reads the
+ * text, so the chunks of a large text can be tokenized by several threads at
+ * once.
+ */
+struct chunk {
+	char *text;		// start of the part, which is NUL-terminated
+	struct vec rules;	// struct chunk_rule
+	struct vec words;	// struct slice
+	bool err;
+};
+
+/**
+ * A tokenized rule.  Its words are its target, its prerequisites and the
+ * arguments of its command, in that order.
+ */
+struct chunk_rule {
+	size_t n_prereq;
+	size_t n_cmd;
+};
+
+/**
+ * Check if c is whitespace other than newline.  The tokenizer does not use
+ * isspace, which depends on the locale, but accepts the same characters as
+ * isspace does in the C locale.
+ */
+static inline bool is_blank(char c)
 {
-	char **ret = malloc((n + 1) * sizeof *ret);
+	return c == ' ' || (c >= '\t' && c <= '\r' && c != '\n');
+}
 
-	for (size_t i = 0; i < n; i++)
-		ret[i] = a[i];
-	ret[n] = NULL;
+/**
+ * Check if c is whitespace.
+ */
+static inline bool is_space(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+/*
+ * The scanners below look at a whole vector of characters at a time.  Loads
+ * are aligned, so they never cross into another page, and the text is always
+ * NUL-terminated, so scanning stops within the page holding the end of the
+ * text even though it may look at characters after it.  A load may also
+ * start before s, in the part of the text another thread is tokenizing, but
+ * the text is not written while it is tokenized.  The characters outside of
+ * the word are ignored, but AddressSanitizer does not know that.
+ */
+#if defined(__AVX2__)
+typedef __m256i simd_t;
+#define SIMD_SIZE 32
+#define SIMD_ALL 0xffffffffu
+#define simd_load(p) _mm256_load_si256(p)
+#define simd_set1(c) _mm256_set1_epi8(c)
+#define simd_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define simd_or(a, b) _mm256_or_si256(a, b)
+#define simd_and(a, b) _mm256_and_si256(a, b)
+#define simd_andnot(a, b) _mm256_andnot_si256(a, b)
+#define simd_subs(a, b) _mm256_subs_epu8(a, b)
+#define simd_mask(a) ((uint32_t)_mm256_movemask_epi8(a))
+#else
+typedef __m128i simd_t;
+#define SIMD_SIZE 16
+#define SIMD_ALL 0xffffu
+#define simd_load(p) _mm_load_si128(p)
+#define simd_set1(c) _mm_set1_epi8(c)
+#define simd_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define simd_or(a, b) _mm_or_si128(a, b)
+#define simd_and(a, b) _mm_and_si128(a, b)
+#define simd_andnot(a, b) _mm_andnot_si128(a, b)
+#define simd_subs(a, b) _mm_subs_epu8(a, b)
+#define simd_mask(a) ((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+#define NO_ASAN __attribute__((no_sanitize_address))
+
+/**
+ * Get a mask with a bit set for each character in x which is whitespace.  If
+ * blank is true, newlines are not counted as whitespace.
+ */
+static inline uint32_t simd_space(simd_t x, bool blank)
+{
+	// '\t' <= c <= '\r' as unsigned saturating differences
+	simd_t zero = simd_set1(0);
+	simd_t ctrl = simd_and(simd_eq(simd_subs(x, simd_set1('\r')), zero),
+			simd_eq(simd_subs(simd_set1('\t'), x), zero));
+	if (blank)
+		ctrl = simd_andnot(simd_eq(x, simd_set1('\n')), ctrl);
+	return simd_mask(simd_or(ctrl, simd_eq(x, simd_set1(' '))));
+}
+
+/**
+ * Get the number of characters at s before the first whitespace, NUL or
+ * delim.
+ */
+NO_ASAN static size_t word_len(const char *s, char delim)
+{
+	const simd_t *v = (const simd_t *)((uintptr_t)s & -(uintptr_t)SIMD_SIZE);
+	unsigned skip = s - (const char *)v;
+	size_t n = -(size_t)skip;
 
-	return ret;
+	for (;; v++, n += SIMD_SIZE, skip = 0) {
+		simd_t x = simd_load(v);
+		uint32_t stop = simd_space(x, false)
+			| simd_mask(simd_eq(x, simd_set1(0)))
+			| simd_mask(simd_eq(x, simd_set1(delim)));
+		stop = stop >> skip << skip;
+		if (stop != 0)
+			return n + __builtin_ctz(stop);
+	}
+}
+
+/**
+ * Get the number of blank characters at s.
+ */
+NO_ASAN static size_t blank_len(const char *s)
+{
+	// words are mostly separated by a single space
+	if (!is_blank(s[0]))
+		return 0;
+	if (!is_blank(s[1]))
+		return 1;
+
+	const simd_t *v = (const simd_t *)((uintptr_t)s & -(uintptr_t)SIMD_SIZE);
+	unsigned skip = s - (const char *)v;
+	size_t n = -(size_t)skip;
+
+	for (;; v++, n += SIMD_SIZE, skip = 0) {
+		uint32_t stop = ~simd_space(simd_load(v), true) & SIMD_ALL;
+		stop = stop >> skip << skip;
+		if (stop != 0)
+			return n + __builtin_ctz(stop);
+	}
+}
+#else
+/**
+ * Get the number of characters at s before the first whitespace, NUL or
+ * delim.
+ */
+static size_t word_len(const char *s, char delim)
+{
+	size_t n = 0;
+	while (s[n] != '\0' && s[n] != delim && !is_space(s[n]))
+		n++;
+	return n;
+}
+
+/**
+ * Get the number of blank characters at s.
+ */
+static size_t blank_len(const char *s)
+{
+	size_t n = 0;
+	while (is_blank(s[n]))
+		n++;
+	return n;
+}
+#endif
+
+/**
+ * Check if the line starting at s is blank.
+ */
+static bool is_blank_line(const char *s)
+{
+	s += blank_len(s);
+	return *s == '\0' || *s == '\n';
+}
+
+/**
+ * Parse a word and update p to point to the first character after the word.
+ * The word is delimited by whitespace and delim, which may be NUL for none.
+ * The returned slice points into the text and has length 0 if there is no
+ * word.
+ */
+static struct slice parse_word(char **p, char delim)
+{
+	size_t n = word_len(*p, delim);
+
+	struct slice w = { *p, n, 0 };
+	*p += n;
+	return w;
+}
+
+/**
+ * Advance p to the start of the next line which is not blank.  Returns the
+ * start of the line or NULL at the end of the text.
+ */
+static char *next_line(char **p)
+{
+	char *s = *p;
+	while (*s != '\0' && is_blank_line(s)) {
+		s = strchrnul(s, '\n');
+		if (*s == '\n')
+			s++;
+	}
+
+	*p = s;
+	return *s != '\0' ? s : NULL;
 }
 
 /**
@@ -99,8 +520,7 @@ static char **dupe_str_array(size_t n, char **a)
  */
 static void skipwhite(char **p)
 {
-	while (isspace(**p) && **p != '\n')
-		(*p)++;
+	*p += blank_len(*p);
 }
 
 /**
@@ -116,99 +536,747 @@ static bool expect(char **p, char c)
 }
 
 /**
- * Parse a rule.
+ * Append a word to the words of c.  Returns false if memory could not be
+ * allocated.
+ */
+static bool push_word(struct chunk *c, struct slice word)
+{
+	struct slice *w = vec_push(&c->words, sizeof *w, 1);
+	if (w == NULL)
+		return false;
+
+	*w = word;
+	return true;
+}
+
+/**
+ * Tokenize a rule.  The names of the target and prerequisites are hashed, but
+ * the words are not terminated in place and the names are not interned until
+ * the rule is added to a parse.
  *
- * @param fp    File to read from.
+ * @param c     The chunk to add the rule to.
+ * @param pp    Pointer into the text, advanced past the rule.
  * @param err   Pointer to flag which gets set to true on error.
- * @return      A parsed rule or NULL.
+ * @return      true if a rule was parsed.
  */
-static rule *parse_rule(FILE *fp, bool *err)
+static bool parse_rule(struct chunk *c, char **pp, bool *err)
 {
-	char buf[MAX_LINE];
 	char *p;
+	struct slice word;
+	size_t first = c->words.n;
 
-	// read line with target and prerequisites
-	if ((p = next_line(buf, fp)) == NULL)
-		return NULL;
+	// find line with target and prerequisites
+	if ((p = next_line(pp)) == NULL)
+		return false;
 
 	// line cannot begin with whitespace
-	if (isspace(*p))
-		goto err0;
+	if (is_space(*p))
+		goto err;
 
-	char *target = parse_word(&p, ":");
+	struct slice target = parse_word(&p, ':');
+	if (target.n == 0 || !push_word(c, target))
+		goto err;
 
 	skipwhite(&p);
 
 	if (!expect(&p, ':'))
-		goto err1;
+		goto err;
 
 	skipwhite(&p);
 
 	// parse prerequisites
-	char *prereq[MAX_PREREQ];
-	size_t n_prereq = 0;
-	while (n_prereq < MAX_PREREQ
-			&& (prereq[n_prereq] = parse_word(&p, "")) != NULL) {
-		n_prereq++;
+	while ((word = parse_word(&p, '\0')).n != 0) {
+		if (!push_word(c, word))
+			goto err;
 		skipwhite(&p);
 	}
+	size_t n_prereq = c->words.n - first - 1;
 	if (!expect(&p, '\n'))
-		goto err2;
+		goto err;
 
-	// read line with command
-	if ((p = next_line(buf, fp)) == NULL)
-		goto err2;
+	// find line with command
+	if (next_line(&p) == NULL)
+		goto err;
 
 	// command has to begin with tab
 	if (!expect(&p, '\t'))
-		goto err2;
+		goto err;
 
 	skipwhite(&p);
 
 	// parse command
-	char *cmd[MAX_CMD];
-	size_t n_cmd = 0;
-	while (n_cmd < MAX_CMD && (cmd[n_cmd] = parse_word(&p, "")) != NULL) {
-		n_cmd++;
+	while ((word = parse_word(&p, '\0')).n != 0) {
+		if (!push_word(c, word))
+			goto err;
 		skipwhite(&p);
 	}
 
-	// create rule
-	rule *r = malloc(sizeof *r);
-	r->target = target;
-	r->prereq = dupe_str_array(n_prereq, prereq);
-	r->cmd = dupe_str_array(n_cmd, cmd);
+	p = strchrnul(p, '\n');
+	if (*p == '\n')
+		p++;
+	*pp = p;
 
-	return r;
+	struct chunk_rule *r = vec_push(&c->rules, sizeof *r, 1);
+	if (r == NULL)
+		goto err;
+	r->n_prereq = n_prereq;
+	r->n_cmd = c->words.n - first - 1 - n_prereq;
 
-err2:
-	for (size_t i = 0; i < n_prereq; i++)
-		free(prereq[i]);
-err1:
-	free(target);
-err0:
+	struct slice *w = (struct slice *)c->words.v + first;
+	for (size_t i = 0; i < 1 + n_prereq; i++)
+		w[i].hash = hash_fnv1a(FNV_OFFSET, w[i].s, w[i].n);
+
+	return true;
+
+err:
 	*err = true;
+	return false;
+}
+
+/**
+ * Terminate the words of the rules tokenized in c in place, intern their
+ * names and add the rules to a parse.  This is done for one chunk at a time,
+ * once no thread is reading the text any more.  The chunk is emptied so that
+ * it can be reused.
+ *
+ * @return      false if memory could not be allocated.
+ */
+static bool add_rules(struct parse *ps, struct chunk *c)
+{
+	makefile *m = ps->m;
+	struct chunk_rule *cr = c->rules.v;
+	struct slice *w = c->words.v;
+
+	for (size_t i = 0; i < c->words.n; i++)
+		w[i].s[w[i].n] = '\0';
+
+	for (size_t i = 0; i < c->rules.n; i++) {
+		struct parsed_rule *r = vec_push(&ps->rules, sizeof *r, 1);
+		if (r == NULL)
+			return false;
+		r->prereq = ps->prereq.n;
+		r->cmd = ps->cmd.n;
+
+		node_id *prereq = vec_push(&ps->prereq, sizeof *prereq,
+				cr[i].n_prereq);
+		uint64_t *cmd = vec_push(&ps->cmd, sizeof *cmd, cr[i].n_cmd);
+		if (prereq == NULL || cmd == NULL)
+			return false;
+
+		struct slice *target = w++;
+		for (size_t j = 0; j < cr[i].n_prereq; j++, w++)
+			if ((prereq[j] = intern(m, w->s, w->n, w->hash)) == NO_NODE)
+				return false;
+		for (size_t j = 0; j < cr[i].n_cmd; j++, w++)
+			cmd[j] = w->s - m->strs;
+		r->target = intern(m, target->s, target->n, target->hash);
+		if (r->target == NO_NODE)
+			return false;
+	}
+
+	c->rules.n = 0;
+	c->words.n = 0;
+	return true;
+}
+
+/**
+ * Tokenize all rules in a chunk.  This is the start routine of the threads of
+ * a parallel parse.
+ */
+static void *parse_chunk(void *arg)
+{
+	struct chunk *c = arg;
+	char *p = c->text;
+
+	while (parse_rule(c, &p, &c->err))
+		;
+
 	return NULL;
 }
 
 /**
- * Parse a makefile.
+ * Find where to split the text of a makefile after p, which is at the start
+ * of a rule: the start of a line which does not begin with whitespace and
+ * which follows a command line.
  *
- * @param path  Path to makefile to parse.
+ * @return      The start of the rule, or NULL if there is none after p.
+ */
+static char *rule_boundary(char *text, char *p)
+{
+	while ((p = strchr(p, '\n')) != NULL) {
+		char *line = ++p;
+		if (*line == '\0' || is_space(*line))
+			continue;
+
+		// find the start of the previous line, which may end a chunk
+		char *prev = line - 1;
+		while (prev > text && prev[-1] != '\n' && prev[-1] != '\0')
+			prev--;
+		if (*prev == '\t')
+			return line;
+	}
+	return NULL;
+}
+
+/**
+ * Number of threads used for a parallel parse, or 0 for one per CPU.
+ */
+static unsigned parse_threads;
+
+/**
+ * Set the number of threads used to parse large makefiles.
+ *
+ * @param n     Number of threads, or 0 to use one per online CPU.
+ */
+void parser_set_threads(unsigned n)
+{
+	parse_threads = n;
+}
+
+/**
+ * Tokenize the text of a makefile with several threads.  The text is split at
+ * rule boundaries into one chunk per thread, and the chunks are added to the
+ * parse in order, so the result is the same as for a sequential parse.
+ *
+ * @param ps    The parse.
+ * @param size  Length of the text.
+ * @param n     Number of threads.
+ * @return      false on error.
+ */
+static bool parse_parallel(struct parse *ps, size_t size, unsigned n)
+{
+	char *text = ps->m->text;
+	struct chunk chunks[MAX_THREADS] = { { 0 } };
+	pthread_t threads[MAX_THREADS];
+	unsigned k = 0;
+
+	// split by replacing the newline before each boundary with a NUL
+	for (char *p = text; p != NULL && k < n; k++) {
+		chunks[k].text = p;
+
+		char *next = k + 1 < n ? text + size / n * (k + 1) : NULL;
+		if (next != NULL)
+			next = rule_boundary(text, next > p ? next : p);
+		if (next != NULL)
+			next[-1] = '\0';
+		p = next;
+	}
+
+	unsigned started = 0;
+	for (; started < k; started++)
+		if (pthread_create(&threads[started], NULL, parse_chunk,
+					&chunks[started]) != 0)
+			break;
+
+	// tokenize whatever could not get a thread here
+	for (unsigned i = started; i < k; i++)
+		parse_chunk(&chunks[i]);
+
+	// the words are terminated only once no thread reads the text
+	for (unsigned i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	bool ok = true;
+	for (unsigned i = 0; i < k; i++) {
+		ok = ok && !chunks[i].err && add_rules(ps, &chunks[i]);
+		free(chunks[i].rules.v);
+		free(chunks[i].words.v);
+	}
+
+	return ok;
+}
+
+/**
+ * Build the graph of a makefile from the rules collected by a parse.
+ *
+ * @return      false if memory could not be allocated.
+ */
+static bool build_graph(struct parse *ps)
+{
+	makefile *m = ps->m;
+	struct parsed_rule *rules = ps->rules.v;
+	size_t n_rules = ps->rules.n;
+	size_t n = m->n_syms;
+
+	// the first rule for each target is the one used to build it
+	size_t *first = malloc(n * sizeof *first);
+	if (first == NULL)
+		return false;
+	for (size_t i = 0; i < n_rules; i++) {
+		struct symbol *sym = &m->syms[rules[i].target];
+		if (!sym->has_rule) {
+			sym->has_rule = true;
+			first[rules[i].target] = i;
+		}
+	}
+
+	m->prereq_off = ARENA_ARRAY(&m->arena, uint64_t, n + 1);
+	m->cmd_off = ARENA_ARRAY(&m->arena, uint64_t, n + 1);
+	m->rules = calloc(n, sizeof *m->rules);
+	if (m->prereq_off == NULL || m->cmd_off == NULL || m->rules == NULL)
+		goto err;
+
+	uint64_t n_prereq = 0, n_cmd = 0;
+	for (size_t i = 0; i < n; i++) {
+		m->prereq_off[i] = n_prereq;
+		m->cmd_off[i] = n_cmd;
+		if (!m->syms[i].has_rule)
+			continue;
+
+		size_t r = first[i];
+		size_t prereq_end = r + 1 < n_rules ? rules[r + 1].prereq : ps->prereq.n;
+		size_t cmd_end = r + 1 < n_rules ? rules[r + 1].cmd : ps->cmd.n;
+		n_prereq += prereq_end - rules[r].prereq;
+		n_cmd += cmd_end - rules[r].cmd;
+	}
+	m->prereq_off[n] = n_prereq;
+	m->cmd_off[n] = n_cmd;
+
+	m->prereq = ARENA_ARRAY(&m->arena, node_id, n_prereq);
+	m->cmd = ARENA_ARRAY(&m->arena, uint64_t, n_cmd);
+	if (m->prereq == NULL || m->cmd == NULL)
+		goto err;
+
+	node_id *prereq = ps->prereq.v;
+	uint64_t *cmd = ps->cmd.v;
+	for (size_t i = 0; i < n; i++) {
+		if (!m->syms[i].has_rule)
+			continue;
+
+		size_t r = first[i];
+		memcpy(m->prereq + m->prereq_off[i], prereq + rules[r].prereq,
+				(m->prereq_off[i + 1] - m->prereq_off[i]) * sizeof *prereq);
+		memcpy(m->cmd + m->cmd_off[i], cmd + rules[r].cmd,
+				(m->cmd_off[i + 1] - m->cmd_off[i]) * sizeof *cmd);
+	}
+
+	m->default_node = rules[0].target;
+	free(first);
+	return true;
+
+err:
+	free(first);
+	return false;
+}
+
+/**
+ * Parse the text of a makefile of length size.  The text must be terminated by
+ * a NUL character and is owned by the returned makefile, or freed on error.
+ */
+static makefile *parse_text(char *text, size_t size, bool mapped)
+{
+	makefile *m = calloc(1, sizeof *m);
+	if (m == NULL) {
+		if (mapped)
+			munmap(text, size);
+		else
+			free(text);
+		return NULL;
+	}
+	m->text = text;
+	m->text_size = size;
+	m->text_mapped = mapped;
+	m->strs = text;
+
+	struct parse ps = { .m = m };
+	bool err = !grow_index(m);
+
+	unsigned n = parse_threads;
+	if (n == 0 && size >= PARALLEL_MIN) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = cpus > 0 ? cpus : 1;
+	}
+	if (n > MAX_THREADS)
+		n = MAX_THREADS;
+
+	if (!err && n > 1) {
+		err = !parse_parallel(&ps, size, n);
+	} else if (!err) {
+		struct chunk c = { .text = text };
+		char *p = text;
+		while (!err && parse_rule(&c, &p, &err))
+			err = !add_rules(&ps, &c);
+		free(c.rules.v);
+		free(c.words.v);
+	}
+
+	if (!err && ps.rules.n > 0)
+		err = !build_graph(&ps);
+	else
+		err = true;
+
+	free(ps.rules.v);
+	free(ps.prereq.v);
+	free(ps.cmd.v);
+
+	if (err) {
+		makefile_del(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+/**
+ * Map the rest of a regular file privately so that the parser can terminate
+ * words in place.  This is only possible when the file does not end on a page
+ * boundary, since the parser relies on the zero-filled tail of the last page to
+ * terminate the text.
+ *
+ * This is not zero-copy: terminating the words writes to nearly every page,
+ * and each page is copied when it is first written.  The copy is intentional,
+ * since it lets rules hand out plain C strings pointing into the text, and it
+ * is made page by page as the parser gets there instead of up front.  Reading
+ * the file into one buffer instead is about as fast.
+ *
+ * @return      The mapping, or NULL if the file could not be mapped.
+ */
+static char *map_file(FILE *fp, size_t *size)
+{
+	struct stat st;
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (ftello(fp) != 0 || fstat(fileno(fp), &st) < 0
+			|| !S_ISREG(st.st_mode) || st.st_size == 0
+			|| page <= 0 || st.st_size % page == 0)
+		return NULL;
+
+	char *text = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fileno(fp), 0);
+	if (text == MAP_FAILED)
+		return NULL;
+	madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+	*size = st.st_size;
+	return text;
+}
+
+/**
+ * Read the rest of fp into a NUL-terminated buffer allocated with malloc, and
+ * set size to the length of the text.
+ *
+ * @return      The buffer, or NULL on error.
+ */
+static char *read_file(FILE *fp, size_t *size)
+{
+	struct stat st;
+	size_t cap = 64 * 1024;
+	if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		cap = st.st_size + 1;
+
+	char *text = malloc(cap);
+	size_t n = 0;
+	while (text != NULL) {
+		n += fread(text + n, 1, cap - n, fp);
+		if (n < cap)
+			break;
+
+		char *t = realloc(text, 2 * cap);
+		if (t == NULL)
+			free(text);
+		text = t;
+		cap *= 2;
+	}
+
+	if (text == NULL || ferror(fp)) {
+		free(text);
+		return NULL;
+	}
+
+	text[n] = '\0';
+	*size = n;
+	return text;
+}
+
+/**
+ * Parse a makefile.  Regular files are mapped into memory and parsed in place,
+ * other streams are read into memory in one go.  Either way the text is copied
+ * once, by copy on write or by the read, and words are never copied out of it.
+ *
+ * @param fp    The file to parse.
  * @return      The makefile.
  */
 makefile *parse_makefile(FILE *fp)
 {
-	makefile *m = malloc(sizeof *m);
-	rule **tailp = &m->rules;
+	char *text;
+	size_t size;
 
-	bool err = false;
-	while ((*tailp = parse_rule(fp, &err)) != NULL)
-		tailp = &(*tailp)->next;
-	*tailp = NULL;
+	if ((text = map_file(fp, &size)) != NULL)
+		return parse_text(text, size, true);
 
-	if (m->rules == NULL || err) {
-		makefile_del(m);
+	if ((text = read_file(fp, &size)) != NULL)
+		return parse_text(text, size, false);
+
+	return NULL;
+}
+
+/**
+ * Parse the makefile at a path.
+ *
+ * @param path  Path to makefile to parse.
+ * @return      The makefile, or NULL if it could not be read or parsed.
+ */
+makefile *parse_makefile_path(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return NULL;
+
+	makefile *m = parse_makefile(fp);
+	fclose(fp);
+	return m;
+}
+
+/**
+ * Parse a makefile held in memory.
+ *
+ * @param buf   The text of the makefile.
+ * @param len   Length of the text.
+ * @return      The makefile, or NULL if it could not be parsed.
+ */
+makefile *parse_makefile_buf(const char *buf, size_t len)
+{
+	char *text = malloc(len + 1);
+	if (text == NULL)
+		return NULL;
+
+	memcpy(text, buf, len);
+	text[len] = '\0';
+	return parse_text(text, len, false);
+}
+
+/**
+ * Write n bytes from p to fp followed by zeros up to a multiple of 8 bytes.
+ */
+static void write_padded(FILE *fp, const void *p, size_t n)
+{
+	static const char zero[8];
+
+	fwrite(p, 1, n, fp);
+	fwrite(zero, 1, ALIGN8(n) - n, fp);
+}
+
+/**
+ * Save a makefile to a cache which can later be loaded with
+ * makefile_load_cache.  The cache is written to a temporary file which is
+ * then renamed to path, so a cache is never seen half written.
+ *
+ * @param make  The makefile.
+ * @param path  Path to the cache.
+ * @param st    Status of the file the makefile was parsed from.
+ * @return      0 on success, -1 on error.
+ */
+int makefile_save_cache(makefile *m, const char *path, const struct stat *st)
+{
+	size_t n = m->n_syms;
+	struct cache_header h = {
+		.byte_order = 0x0102030405060708,
+		.dev = st->st_dev,
+		.ino = st->st_ino,
+		.size = st->st_size,
+		.mtime_sec = st->st_mtim.tv_sec,
+		.mtime_nsec = st->st_mtim.tv_nsec,
+		.ctime_sec = st->st_ctim.tv_sec,
+		.ctime_nsec = st->st_ctim.tv_nsec,
+		.n_syms = n,
+		.index_cap = m->index_mask + 1,
+		.n_prereq = m->prereq_off[n],
+		.n_cmd = m->cmd_off[n],
+		.default_node = m->default_node,
+	};
+	memcpy(h.magic, CACHE_MAGIC, sizeof h.magic);
+
+	// names are stored first in the cache, followed by the arguments
+	uint64_t names_size = 0;
+	for (size_t i = 0; i < n; i++)
+		names_size += m->syms[i].len + 1;
+	h.strs_size = names_size;
+	for (size_t i = 0; i < h.n_cmd; i++)
+		h.strs_size += strlen(m->strs + m->cmd[i]) + 1;
+
+	char *tmp;
+	int fd = temp_file_open(path, &tmp);
+	if (fd < 0)
+		return -1;
+	FILE *fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		return temp_file_finish(tmp, path, false);
+	}
+
+	fwrite(&h, sizeof h, 1, fp);
+
+	uint64_t off = 0;
+	for (size_t i = 0; i < n; i++) {
+		struct symbol sym = m->syms[i];
+		sym.name = off;
+		off += sym.len + 1;
+		fwrite(&sym, sizeof sym, 1, fp);
+	}
+
+	write_padded(fp, m->index, h.index_cap * sizeof *m->index);
+	write_padded(fp, m->prereq_off, (n + 1) * sizeof *m->prereq_off);
+	write_padded(fp, m->prereq, h.n_prereq * sizeof *m->prereq);
+	write_padded(fp, m->cmd_off, (n + 1) * sizeof *m->cmd_off);
+
+	for (size_t i = 0; i < h.n_cmd; i++) {
+		fwrite(&off, sizeof off, 1, fp);
+		off += strlen(m->strs + m->cmd[i]) + 1;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		fwrite(m->strs + m->syms[i].name, 1, m->syms[i].len + 1, fp);
+	for (size_t i = 0; i < h.n_cmd; i++) {
+		const char *arg = m->strs + m->cmd[i];
+		fwrite(arg, 1, strlen(arg) + 1, fp);
+	}
+
+	bool err = ferror(fp);
+	return temp_file_finish(tmp, path, fclose(fp) == 0 && !err);
+}
+
+/**
+ * Check that the offsets of a row of the graph start at 0, never decrease and
+ * end at the number of entries.
+ */
+static bool rows_valid(const uint64_t *off, size_t n, uint64_t total)
+{
+	if (off[0] != 0 || off[n] != total)
+		return false;
+
+	for (size_t i = 0; i < n; i++)
+		if (off[i] > off[i + 1])
+			return false;
+	return true;
+}
+
+/**
+ * Check that the tables of a makefile loaded from a cache only refer to nodes
+ * and strings within the cache, so that a corrupt cache is never read out of
+ * bounds.
+ */
+static bool cache_valid(const makefile *m, const struct cache_header *h)
+{
+	size_t n = m->n_syms;
+
+	// every string offset is then followed by a NUL within the cache
+	if (h->strs_size == 0 || m->strs[h->strs_size - 1] != '\0')
+		return false;
+
+	for (size_t i = 0; i < n; i++)
+		if (m->syms[i].name >= h->strs_size
+				|| m->syms[i].len >= h->strs_size - m->syms[i].name)
+			return false;
+
+	// lookups stop at an empty slot, so there must be one
+	size_t used = 0;
+	for (size_t i = 0; i <= m->index_mask; i++) {
+		if (m->index[i] > n)
+			return false;
+		used += m->index[i] != 0;
+	}
+	if (used > m->index_mask)
+		return false;
+
+	if (!rows_valid(m->prereq_off, n, h->n_prereq)
+			|| !rows_valid(m->cmd_off, n, h->n_cmd))
+		return false;
+
+	for (uint64_t i = 0; i < h->n_prereq; i++)
+		if (m->prereq[i] >= n)
+			return false;
+
+	for (uint64_t i = 0; i < h->n_cmd; i++)
+		if (m->cmd[i] >= h->strs_size)
+			return false;
+
+	return true;
+}
+
+/**
+ * Load a makefile from a cache written by makefile_save_cache.  The cache is
+ * mapped into memory and used as it is, so loading needs no parsing, only a
+ * pass over the tables to check that they are consistent.
+ *
+ * @param path  Path to the cache.
+ * @param st    Status of the makefile.  The cache is only used if it was made
+ *              from a file with the same device, inode, size, modification
+ *              time and change time.
+ * @return      The makefile, or NULL if there is no usable cache.
+ */
+makefile *makefile_load_cache(const char *path, const struct stat *st)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat cst;
+	if (fstat(fd, &cst) < 0 || (size_t)cst.st_size < sizeof(struct cache_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	char *map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	// the sizes are bounded first, so the layout below cannot overflow
+	const struct cache_header *h = (const void *)map;
+	uint64_t size = cst.st_size;
+	bool bounded = h->n_syms <= size / sizeof(struct symbol)
+		&& h->index_cap <= size / sizeof(node_id)
+		&& h->n_prereq <= size / sizeof(node_id)
+		&& h->n_cmd <= size / sizeof(uint64_t)
+		&& h->strs_size <= size;
+
+	uint64_t syms = sizeof *h;
+	uint64_t index = syms + h->n_syms * sizeof(struct symbol);
+	uint64_t prereq_off = index + ALIGN8(h->index_cap * sizeof(node_id));
+	uint64_t prereq = prereq_off + (h->n_syms + 1) * sizeof(uint64_t);
+	uint64_t cmd_off = prereq + ALIGN8(h->n_prereq * sizeof(node_id));
+	uint64_t cmd = cmd_off + (h->n_syms + 1) * sizeof(uint64_t);
+	uint64_t strs = cmd + h->n_cmd * sizeof(uint64_t);
+
+	makefile *m = NULL;
+	if (!bounded || memcmp(h->magic, CACHE_MAGIC, sizeof h->magic) != 0
+			|| h->byte_order != 0x0102030405060708
+			|| h->dev != (uint64_t)st->st_dev
+			|| h->ino != (uint64_t)st->st_ino
+			|| h->size != (uint64_t)st->st_size
+			|| h->mtime_sec != st->st_mtim.tv_sec
+			|| h->mtime_nsec != st->st_mtim.tv_nsec
+			|| h->ctime_sec != st->st_ctim.tv_sec
+			|| h->ctime_nsec != st->st_ctim.tv_nsec
+			|| h->n_syms == 0 || h->default_node >= h->n_syms
+			|| h->index_cap == 0 || (h->index_cap & (h->index_cap - 1)) != 0
+			|| strs + h->strs_size != size
+			|| (m = calloc(1, sizeof *m)) == NULL
+			|| (m->rules = calloc(h->n_syms, sizeof *m->rules)) == NULL) {
+		free(m);
+		munmap(map, cst.st_size);
+		return NULL;
+	}
+
+	m->text = map;
+	m->text_size = cst.st_size;
+	m->text_mapped = true;
+	m->cached = true;
+	m->strs = map + strs;
+	m->syms = (void *)(map + syms);
+	m->n_syms = h->n_syms;
+	m->index = (void *)(map + index);
+	m->index_mask = h->index_cap - 1;
+	m->prereq_off = (void *)(map + prereq_off);
+	m->prereq = (void *)(map + prereq);
+	m->cmd_off = (void *)(map + cmd_off);
+	m->cmd = (void *)(map + cmd);
+	m->default_node = h->default_node;
+
+	if (!cache_valid(m, h)) {
+		free(m->rules);
+		free(m);
+		munmap(map, cst.st_size);
 		return NULL;
 	}
 
@@ -224,7 +1292,7 @@ makefile *parse_makefile(FILE *fp)
  */
 const char *makefile_default_target(makefile *m)
 {
-	return m->rules->target;
+	return makefile_node_name(m, m->default_node);
 }
 
 /**
@@ -236,11 +1304,88 @@ const char *makefile_default_target(makefile *m)
  */
 rule *makefile_rule(makefile *m, const char *target)
 {
-	for (rule *i = m->rules; i != NULL; i = i->next)
-		if (strcmp(i->target, target) == 0)
-			return i;
+	return makefile_node_rule(m, makefile_node(m, target));
+}
 
-	return NULL;
+/**
+ * Get the number of nodes in a makefile.
+ *
+ * @param make  The makefile.
+ * @return      Number of distinct targets and prerequisites.
+ */
+size_t makefile_nodes(makefile *m)
+{
+	return m->n_syms;
+}
+
+/**
+ * Get the node for a name.
+ *
+ * @param make  The makefile.
+ * @param name  Name of a target or prerequisite.
+ * @return      The node, or NO_NODE if the name does not occur in the makefile.
+ */
+node_id makefile_node(makefile *m, const char *name)
+{
+	size_t n = strlen(name);
+	size_t i = index_slot(m, name, n, hash_fnv1a(FNV_OFFSET, name, n));
+	return m->index[i] != 0 ? m->index[i] - 1 : NO_NODE;
+}
+
+/**
+ * Get the prerequisite graph of a makefile in compressed sparse row form.
+ *
+ * @param make  The makefile.
+ * @param edges Set to the array of prerequisites of all nodes.
+ * @return      Array of offsets into edges, indexed by node.
+ */
+const uint64_t *makefile_graph(makefile *m, const node_id **edges)
+{
+	*edges = m->prereq;
+	return m->prereq_off;
+}
+
+/**
+ * Get the name of a node.
+ *
+ * @param make  The makefile.
+ * @param node  A node in the makefile.
+ * @return      Name of the node.
+ */
+const char *makefile_node_name(makefile *m, node_id node)
+{
+	return m->strs + m->syms[node].name;
+}
+
+/**
+ * Get the rule for building a node.
+ *
+ * @param make  The makefile.
+ * @param node  A node in the makefile, or NO_NODE.
+ * @return      The rule for building the node, or NULL if there is none.
+ */
+rule *makefile_node_rule(makefile *m, node_id node)
+{
+	if (node == NO_NODE || !m->syms[node].has_rule)
+		return NULL;
+
+	rule *r = &m->rules[node];
+	if (r->make == NULL) {
+		r->make = m;
+		r->target = node;
+	}
+	return r;
+}
+
+/**
+ * Get the node built by a rule.
+ *
+ * @param rule  The rule.
+ * @return      The target of the rule.
+ */
+node_id rule_target(rule *rule)
+{
+	return rule->target;
 }
 
 /**
@@ -252,53 +1397,90 @@ rule *makefile_rule(makefile *m, const char *target)
  */
 const char **rule_prereq(rule *rule)
 {
-	return (const char **)rule->prereq;
+	if (rule->prereq_names != NULL)
+		return rule->prereq_names;
+
+	size_t n;
+	const node_id *prereq = rule_prereq_nodes(rule, &n);
+
+	makefile *m = rule->make;
+	const char **names = ARENA_ARRAY(&m->arena, const char *, n + 1);
+	if (names == NULL)
+		return NULL;
+
+	for (size_t i = 0; i < n; i++)
+		names[i] = makefile_node_name(m, prereq[i]);
+	names[n] = NULL;
+
+	return rule->prereq_names = names;
 }
 
 /**
- * Get the command for a rule.
+ * Get the prerequisites for a rule as nodes.
  *
  * @param rule  The rule.
- * @return      Array containing the arguments for the command used to build
- *              the rule.  The first argument is the name of the command.  The
- *              array is terminated with NULL.
+ * @param n     Set to the number of prerequisites.
+ * @return      Array containing the prerequisites for the rule.
  */
-char **rule_cmd(rule *rule)
+const node_id *rule_prereq_nodes(rule *rule, size_t *n)
 {
-	return rule->cmd;
+	const node_id *edges;
+	const uint64_t *off = makefile_graph(rule->make, &edges);
+
+	*n = off[rule->target + 1] - off[rule->target];
+	return edges + off[rule->target];
 }
 
 /**
- * Recursively delete a list of rules.
+ * Get the command for a rule.
+ *
+ * @param rule  The rule.
+ * @return      Array containing the arguments for the command used to build
+ *              the rule.  The first argument is the name of the command.  The
+ *              array is terminated with NULL.
  */
-static void del_rules(struct rule *rules)
+char **rule_cmd(rule *rule)
 {
-	if (rules == NULL)
-		return;
+	if (rule->cmd != NULL)
+		return rule->cmd;
 
-	free(rules->target);
+	makefile *m = rule->make;
+	uint64_t off = m->cmd_off[rule->target];
+	size_t n = m->cmd_off[rule->target + 1] - off;
 
-	for (size_t i = 0; rules->prereq[i] != NULL; i++)
-		free(rules->prereq[i]);
-	free(rules->prereq);
-
-	for (size_t i = 0; rules->cmd[i] != NULL; i++)
-		free(rules->cmd[i]);
-	free(rules->cmd);
+	char **cmd = ARENA_ARRAY(&m->arena, char *, n + 1);
+	if (cmd == NULL)
+		return NULL;
 
-	del_rules(rules->next);
+	// the arguments may be in a read-only cache, but are never written
+	for (size_t i = 0; i < n; i++)
+		cmd[i] = (char *)m->strs + m->cmd[off + i];
+	cmd[n] = NULL;
 
-	free(rules);
+	return rule->cmd = cmd;
 }
 
 /**
  * Free the memory of a makefile.  This will also delete the rules from the
- * makefile returned by makefile_rule.
+ * makefile returned by makefile_rule.  Everything is released in bulk, so the
+ * time this takes does not depend on the number of rules.
  *
  * @param make  Makefile to delete.
  */
 void makefile_del(makefile *make)
 {
-	del_rules(make->rules);
+	arena_free(&make->arena);
+	free(make->rules);
+
+	if (!make->cached) {
+		free(make->syms);
+		free(make->index);
+	}
+
+	if (make->text_mapped)
+		munmap(make->text, make->text_size);
+	else
+		free(make->text);
+
 	free(make);
 }
@@ -11,18 +11,82 @@
 #define PARSER_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 typedef struct makefile makefile;
 typedef struct rule rule;
 
 /**
- * Parse a makefile.
+ * Every distinct target and prerequisite name in a makefile is a node,
+ * numbered densely from 0.
+ */
+typedef uint32_t node_id;
+
+#define NO_NODE ((node_id)-1)
+
+/**
+ * Parse a makefile.  The text is held in memory, copied once from the file,
+ * and the names and commands of the rules point into it.
  *
  * @param fp    The file to parse.
  * @return      The makefile.
  */
 makefile *parse_makefile(FILE *fp);
 
+/**
+ * Parse the makefile at a path.
+ *
+ * @param path  Path to makefile to parse.
+ * @return      The makefile, or NULL if it could not be read or parsed.
+ */
+makefile *parse_makefile_path(const char *path);
+
+/**
+ * Parse a makefile held in memory.  The text is copied once, so buf does not
+ * need to outlive the makefile.
+ *
+ * @param buf   The text of the makefile.
+ * @param len   Length of the text.
+ * @return      The makefile, or NULL if it could not be parsed.
+ */
+makefile *parse_makefile_buf(const char *buf, size_t len);
+
+/**
+ * Set the number of threads used to parse large makefiles.  A large makefile
+ * is split into chunks at rule boundaries which are tokenized concurrently.
+ * The result is the same as when parsing with a single thread.
+ *
+ * @param n     Number of threads, or 0 to use one per online CPU.
+ */
+void parser_set_threads(unsigned n);
+
+/**
+ * Load a makefile from a cache written by makefile_save_cache.  The cache is
+ * mapped into memory and used as it is, so loading needs no parsing.  Its
+ * tables are checked to refer only to nodes and strings within the cache.
+ *
+ * @param path  Path to the cache.
+ * @param st    Status of the makefile.  The cache is only used if it was made
+ *              from a file with the same device, inode, size, modification
+ *              time and change time, and is consistent.
+ * @return      The makefile, or NULL if there is no usable cache.
+ */
+makefile *makefile_load_cache(const char *path, const struct stat *st);
+
+/**
+ * Save a makefile to a cache which can later be loaded with
+ * makefile_load_cache.  The cache is written to a temporary file which is
+ * then renamed to path, so a cache is never seen half written.
+ *
+ * @param make  The makefile.
+ * @param path  Path to the cache.
+ * @param st    Status of the file the makefile was parsed from.
+ * @return      0 on success, -1 on error.
+ */
+int makefile_save_cache(makefile *make, const char *path,
+		const struct stat *st);
+
 /**
  * Get the default target for a makefile.  The default target is the target
  * from the first rule.
@@ -41,6 +105,64 @@ const char *makefile_default_target(makefile *make);
  */
 rule *makefile_rule(makefile *make, const char *target);
 
+/**
+ * Get the number of nodes in a makefile.  Nodes are numbered from 0 up to but
+ * not including this number.
+ *
+ * @param make  The makefile.
+ * @return      Number of distinct targets and prerequisites.
+ */
+size_t makefile_nodes(makefile *make);
+
+/**
+ * Get the node for a name.
+ *
+ * @param make  The makefile.
+ * @param name  Name of a target or prerequisite.
+ * @return      The node, or NO_NODE if the name does not occur in the makefile.
+ */
+node_id makefile_node(makefile *make, const char *name);
+
+/**
+ * Get the prerequisite graph of a makefile in compressed sparse row form.  The
+ * prerequisites of node n are edges[offsets[n]] up to but not including
+ * edges[offsets[n + 1]], in the order they are listed in the rule for n.
+ * Nodes which are not the target of a rule have no prerequisites.  The arrays
+ * are owned by the makefile.
+ *
+ * @param make  The makefile.
+ * @param edges Set to the array of prerequisites of all nodes.
+ * @return      Array of makefile_nodes(make) + 1 offsets into edges, indexed
+ *              by node.
+ */
+const uint64_t *makefile_graph(makefile *make, const node_id **edges);
+
+/**
+ * Get the name of a node.
+ *
+ * @param make  The makefile.
+ * @param node  A node in the makefile.
+ * @return      Name of the node.
+ */
+const char *makefile_node_name(makefile *make, node_id node);
+
+/**
+ * Get the rule for building a node.
+ *
+ * @param make  The makefile.
+ * @param node  A node in the makefile, or NO_NODE.
+ * @return      The rule for building the node, or NULL if there is none.
+ */
+rule *makefile_node_rule(makefile *make, node_id node);
+
+/**
+ * Get the node built by a rule.
+ *
+ * @param rule  The rule.
+ * @return      The target of the rule.
+ */
+node_id rule_target(rule *rule);
+
 /**
  * Get the prerequisites for a rule.
  *
@@ -50,6 +172,15 @@ rule *makefile_rule(makefile *make, const char *target);
  */
 const char **rule_prereq(rule *rule);
 
+/**
+ * Get the prerequisites for a rule as nodes.
+ *
+ * @param rule  The rule.
+ * @param n     Set to the number of prerequisites.
+ * @return      Array containing the prerequisites for the rule.
+ */
+const node_id *rule_prereq_nodes(rule *rule, size_t *n);
+
 /**
  * Get the command for a rule.
  *
@@ -0,0 +1,356 @@
+/**
+ * Cache of the status of the files named by the nodes of a makefile.
+ *
+ * @file statcache.c
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "statcache.h"
+
+#define URING_ENTRIES 256
+#define PREFETCH_THREADS 16
+
+/**
+ * The cache holds one entry for each node, so a lookup is an index into an
+ * array and never hashes the name of the file.
+ */
+struct stat_cache {
+	makefile *make;
+	struct entry *entries;
+	uint64_t lookups;
+	uint64_t calls;
+};
+
+struct entry {
+	bool valid;
+	bool queued;	// waiting to be filled in by a prefetch
+	struct file_status status;
+};
+
+/**
+ * Nodes to stat in a prefetch.  Workers take the next node to stat with an
+ * atomic increment of next.
+ */
+struct prefetch {
+	stat_cache *c;
+	const node_id *todo;
+	size_t n;
+	size_t next;
+};
+
+/**
+ * Fill in an entry from the result of statx().
+ */
+static void set_status(struct entry *e, bool exists, const struct statx *stx)
+{
+	e->status.exists = exists;
+	e->status.mtime = exists ? (timestamp)stx->stx_mtime.tv_sec * 1000000000
+			+ stx->stx_mtime.tv_nsec : 0;
+	e->status.ino = exists ? stx->stx_ino : 0;
+	e->status.size = exists ? stx->stx_size : 0;
+	e->valid = true;
+	e->queued = false;
+}
+
+/**
+ * Create an empty cache for the nodes of a makefile.
+ *
+ * @param m     The makefile, which must outlive the cache.
+ * @return      The cache, or NULL if memory could not be allocated.
+ */
+stat_cache *stat_cache_new(makefile *m)
+{
+	stat_cache *c = calloc(1, sizeof *c);
+	if (c == NULL)
+		return NULL;
+
+	c->make = m;
+	if ((c->entries = calloc(makefile_nodes(m), sizeof *c->entries)) == NULL) {
+		free(c);
+		return NULL;
+	}
+
+	return c;
+}
+
+/**
+ * Get the status of the file of a node, calling stat() on the file the first
+ * time it is asked for.
+ *
+ * @param c     The cache.
+ * @param node  The node.
+ * @return      The status, which stays valid until the node is invalidated.
+ */
+const struct file_status *stat_cache_get(stat_cache *c, node_id node)
+{
+	struct entry *e = &c->entries[node];
+
+	c->lookups++;
+	if (!e->valid) {
+		struct stat st;
+
+		c->calls++;
+		e->status.exists = stat(makefile_node_name(c->make, node), &st) == 0;
+		e->status.mtime = e->status.exists
+				? timestamp_from_timespec(st.st_mtim) : 0;
+		e->status.ino = e->status.exists ? st.st_ino : 0;
+		e->status.size = e->status.exists ? st.st_size : 0;
+		e->valid = true;
+	}
+
+	return &e->status;
+}
+
+/**
+ * Stat the files of nodes through an io_uring, submitting a batch of
+ * IORING_OP_STATX requests at a time and waiting for the whole batch.  The
+ * ring is set up with raw system calls.
+ *
+ * @return      Number of nodes, from the start of todo, that were stat'd.  This
+ *              is 0 if io_uring is not available.
+ */
+static size_t prefetch_uring(stat_cache *c, const node_id *todo, size_t n)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof p);
+
+	int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (fd < 0)
+		return 0;
+
+	size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if (single && cq_size > sq_size)
+		sq_size = cq_size;
+
+	char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	char *cq = single ? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	struct io_uring_sqe *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	struct statx *bufs = malloc(p.sq_entries * sizeof *bufs);
+
+	size_t done = 0;
+	bool in_flight = false;
+	if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED
+			|| bufs == NULL)
+		goto out;
+
+	unsigned *sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	unsigned sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	unsigned *sq_array = (unsigned *)(sq + p.sq_off.array);
+	unsigned *cq_head = (unsigned *)(cq + p.cq_off.head);
+	unsigned *cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	unsigned cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	struct io_uring_cqe *cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	while (done < n) {
+		unsigned batch = n - done < p.sq_entries ? n - done : p.sq_entries;
+		unsigned tail = *sq_tail;
+
+		for (unsigned i = 0; i < batch; i++) {
+			unsigned idx = (tail + i) & sq_mask;
+			struct io_uring_sqe *sqe = &sqes[idx];
+
+			memset(sqe, 0, sizeof *sqe);
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)makefile_node_name(c->make, todo[done + i]);
+			sqe->len = STATX_MTIME | STATX_INO | STATX_SIZE;
+			sqe->off = (uintptr_t)&bufs[i];
+			sqe->user_data = i;
+			sq_array[idx] = idx;
+		}
+		__atomic_store_n(sq_tail, tail + batch, __ATOMIC_RELEASE);
+
+		// submit the batch and reap its completions as they arrive
+		unsigned submitted = 0, reaped = 0;
+		bool unsupported = false;
+		while (reaped < batch) {
+			int r = syscall(__NR_io_uring_enter, fd, batch - submitted, 1,
+					IORING_ENTER_GETEVENTS, NULL, 0);
+			if (r < 0 && errno != EINTR) {
+				// the kernel may still write to bufs, so keep them
+				in_flight = submitted > 0;
+				goto out;
+			}
+			submitted += r > 0 ? r : 0;
+
+			unsigned head = *cq_head;
+			unsigned end = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+			for (; head != end; head++, reaped++) {
+				struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+				unsigned i = cqe->user_data;
+
+				if (cqe->res == -EINVAL) {
+					// statx is not supported by this kernel's io_uring
+					unsupported = true;
+					continue;
+				}
+				set_status(&c->entries[todo[done + i]], cqe->res == 0, &bufs[i]);
+			}
+			__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+		}
+
+		if (unsupported)
+			goto out;
+		done += batch;
+	}
+
+out:
+	if (!in_flight)
+		free(bufs);
+	if (sqes != MAP_FAILED)
+		munmap(sqes, sqes_size);
+	if (cq != MAP_FAILED && cq != sq)
+		munmap(cq, cq_size);
+	if (sq != MAP_FAILED)
+		munmap(sq, sq_size);
+	close(fd);
+
+	return done;
+}
+
+/**
+ * Stat the files of the nodes of a prefetch which have not been taken by
+ * another worker.  This is the start routine of the threads of a prefetch.
+ */
+static void *prefetch_worker(void *arg)
+{
+	struct prefetch *pf = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&pf->next, 1, __ATOMIC_RELAXED)) < pf->n) {
+		struct entry *e = &pf->c->entries[pf->todo[i]];
+		struct statx stx;
+
+		if (e->valid)
+			continue;
+		const char *name = makefile_node_name(pf->c->make, pf->todo[i]);
+		bool exists = statx(AT_FDCWD, name, 0, STATX_MTIME | STATX_INO
+				| STATX_SIZE, &stx) == 0;
+		set_status(e, exists, &stx);
+	}
+
+	return NULL;
+}
+
+/**
+ * Stat the files of nodes with a pool of threads calling statx().  The calling
+ * thread works too, so all nodes are stat'd even if no thread can be created.
+ */
+static void prefetch_threads(stat_cache *c, const node_id *todo, size_t n)
+{
+	struct prefetch pf = { .c = c, .todo = todo, .n = n };
+	pthread_t threads[PREFETCH_THREADS];
+	size_t n_threads = 0;
+
+	while (n_threads < PREFETCH_THREADS && n_threads + 1 < n
+			&& pthread_create(&threads[n_threads], NULL, prefetch_worker,
+				&pf) == 0)
+		n_threads++;
+
+	prefetch_worker(&pf);
+	for (size_t i = 0; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/**
+ * Fill in the status of the files of nodes and of their prerequisites.  The
+ * files are stat'd in batches through io_uring if it can be used, otherwise by
+ * a pool of threads.
+ *
+ * @param c     The cache.
+ * @param nodes The nodes.
+ * @param n     Number of nodes.
+ */
+void stat_cache_prefetch(stat_cache *c, const node_id *nodes, size_t n)
+{
+	const node_id *edges;
+	const uint64_t *offsets = makefile_graph(c->make, &edges);
+	size_t n_todo = 0, cap = n;
+	node_id *todo = malloc(cap * sizeof *todo);
+
+	for (size_t i = 0; todo != NULL && i < n; i++) {
+		uint64_t first = offsets[nodes[i]], end = offsets[nodes[i] + 1];
+
+		if (n_todo + 1 + (end - first) > cap) {
+			cap = 2 * (n_todo + 1 + (end - first));
+			node_id *t = realloc(todo, cap * sizeof *todo);
+			if (t == NULL)
+				break;
+			todo = t;
+		}
+
+		// each file is only queued once
+		for (uint64_t e = first; e <= end; e++) {
+			node_id node = e < end ? edges[e] : nodes[i];
+			struct entry *en = &c->entries[node];
+			if (!en->valid && !en->queued) {
+				en->queued = true;
+				todo[n_todo++] = node;
+			}
+		}
+	}
+
+	// files left out if memory ran short are stat'd on first use instead
+	if (todo == NULL)
+		return;
+
+	size_t done = prefetch_uring(c, todo, n_todo);
+	prefetch_threads(c, todo + done, n_todo - done);
+	c->calls += n_todo;
+
+	for (size_t i = 0; i < n_todo; i++)
+		c->entries[todo[i]].queued = false;
+	free(todo);
+}
+
+/**
+ * Forget the status of the file of a node.
+ *
+ * @param c     The cache.
+ * @param node  The node.
+ */
+void stat_cache_invalidate(stat_cache *c, node_id node)
+{
+	c->entries[node].valid = false;
+}
+
+/**
+ * Get the number of lookups and stat() calls made.
+ *
+ * @param c         The cache.
+ * @param lookups   Set to the number of lookups.
+ * @param calls     Set to the number of stat() calls.
+ */
+void stat_cache_counts(stat_cache *c, uint64_t *lookups, uint64_t *calls)
+{
+	*lookups = c->lookups;
+	*calls = c->calls;
+}
+
+/**
+ * Free the memory of a cache.
+ *
+ * @param c     The cache to delete.
+ */
+void stat_cache_del(stat_cache *c)
+{
+	free(c->entries);
+	free(c);
+}
@@ -0,0 +1,97 @@
+/**
+ * Cache of the status of the files named by the nodes of a makefile.  Each
+ * file is stat'd at most once per run, unless the command making it has run
+ * since then.
+ *
+ * @file statcache.h
+ */
+#ifndef STATCACHE_H
+#define STATCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "parser.h"
+
+typedef struct stat_cache stat_cache;
+
+/**
+ * A point in time in nanoseconds since the epoch, which is how all times of
+ * files are kept and compared.
+ */
+typedef int64_t timestamp;
+
+/**
+ * Convert a time as returned in struct stat to a timestamp.
+ */
+static inline timestamp timestamp_from_timespec(struct timespec ts)
+{
+	return (timestamp)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * What is known about the file of a node.
+ */
+struct file_status {
+	bool exists;
+	timestamp mtime;
+	uint64_t ino;
+	uint64_t size;
+};
+
+/**
+ * Create an empty cache for the nodes of a makefile.
+ *
+ * @param m     The makefile, which must outlive the cache.
+ * @return      The cache, or NULL if memory could not be allocated.
+ */
+stat_cache *stat_cache_new(makefile *m);
+
+/**
+ * Get the status of the file of a node, calling stat() on the file the first
+ * time it is asked for.  Symbolic links are followed.
+ *
+ * @param c     The cache.
+ * @param node  The node.
+ * @return      The status, which stays valid until the node is invalidated.
+ */
+const struct file_status *stat_cache_get(stat_cache *c, node_id node);
+
+/**
+ * Fill in the status of the files of nodes and of their prerequisites before
+ * they are asked for.  The files are stat'd in batches through io_uring if the
+ * kernel allows it, otherwise by a pool of threads, so that the latency of
+ * many stat calls overlaps.  Files already in the cache are not stat'd again.
+ *
+ * @param c     The cache.
+ * @param nodes The nodes.
+ * @param n     Number of nodes.
+ */
+void stat_cache_prefetch(stat_cache *c, const node_id *nodes, size_t n);
+
+/**
+ * Forget the status of the file of a node, because it may have changed.
+ *
+ * @param c     The cache.
+ * @param node  The node.
+ */
+void stat_cache_invalidate(stat_cache *c, node_id node);
+
+/**
+ * Get the number of lookups made in the cache and the number of those that had
+ * to call stat().
+ *
+ * @param c         The cache.
+ * @param lookups   Set to the number of lookups.
+ * @param calls     Set to the number of stat() calls.
+ */
+void stat_cache_counts(stat_cache *c, uint64_t *lookups, uint64_t *calls);
+
+/**
+ * Free the memory of a cache.
+ *
+ * @param c     The cache to delete.
+ */
+void stat_cache_del(stat_cache *c);
+
+#endif
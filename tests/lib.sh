@@ -0,0 +1,35 @@
+# Shared setup of the tests, sourced by each of them.  A test runs in a
+# directory of its own, which is removed when it exits.
+
+MMAKE=$(cd "$(dirname "$0")/.." && pwd)/mmake
+TESTS=$(cd "$(dirname "$0")" && pwd)
+NAME=$(basename "$0" .sh)
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+# A command for rules which counts how many times it has been run
+cat > count <<'EOF'
+#!/bin/sh
+echo run >> runs
+EOF
+chmod +x count
+
+fail()
+{
+	echo "$NAME: FAIL: $*"
+	exit 1
+}
+
+# Run mmake with the given options and check that the count command ran
+# the expected number of times
+expect_runs()
+{
+	want=$1
+	shift
+	rm -f runs
+	"$MMAKE" -s "$@" || fail "mmake $* exited with $?"
+	got=$(cat runs 2>/dev/null | wc -l)
+	[ "$got" -eq "$want" ] || fail "mmake $*: command ran $got times, not $want"
+}
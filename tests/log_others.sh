@@ -0,0 +1,27 @@
+#!/bin/sh
+# Makefiles in the same directory share the build log.  When the log is
+# compacted by a run of one of them, the records of the others are kept, so
+# that a changed command in another makefile still rebuilds its target.
+. "$(dirname "$0")/lib.sh"
+
+printf 'b: src\n\ttouch b\n' > b.mk
+awk 'BEGIN {
+	printf "all:"
+	for (i = 0; i < 400; i++)
+		printf " a%d", i
+	printf "\n\ttouch all\n"
+	for (i = 0; i < 400; i++)
+		printf "\na%d: src\n\ttouch a%d\n", i, i
+}' > a.mk
+touch src
+"$MMAKE" -s -f b.mk || fail "mmake -f b.mk exited with $?"
+
+# enough superseded records of a.mk for the log to be compacted
+for i in 1 2 3 4 5; do
+	"$MMAKE" -s -B -f a.mk || fail "mmake -B -f a.mk exited with $?"
+done
+
+printf 'b: src\n\t./count b\n' > b.mk
+expect_runs 1 -f b.mk
+
+echo "$NAME: ok"
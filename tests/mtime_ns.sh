@@ -0,0 +1,29 @@
+#!/bin/sh
+# File times are compared to the nanosecond: a prerequisite 1 ns newer than
+# its target makes it stale, while one as old or older does not.
+. "$(dirname "$0")/lib.sh"
+
+printf 'out: in\n\t./count\n' > mmakefile
+touch in out
+
+T=1700000000
+
+# set_mtime TARGET_NSEC PREREQ_NSEC, both within the same second
+set_mtime()
+{
+	"$TESTS/set_mtime" $T "$1" out || fail "set_mtime $T $1 out"
+	"$TESTS/set_mtime" $T "$2" in || fail "set_mtime $T $2 in"
+}
+
+for opt in "" --prefetch; do
+	set_mtime 500000000 500000001
+	expect_runs 1 $opt
+	set_mtime 500000000 500000000
+	expect_runs 0 $opt
+	set_mtime 500000001 500000000
+	expect_runs 0 $opt
+	set_mtime 0 999999999
+	expect_runs 1 $opt
+done
+
+echo "$NAME: ok"
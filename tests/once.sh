@@ -0,0 +1,28 @@
+#!/bin/sh
+# A target with 40 stale prerequisites runs its command once, not once for
+# each of them.
+. "$(dirname "$0")/lib.sh"
+
+printf 'all:' > mmakefile
+i=0
+while [ $i -lt 40 ]; do
+	printf ' src%d' $i >> mmakefile
+	i=$((i + 1))
+done
+printf '\n\t./count\n' >> mmakefile
+
+touch -d '2000-01-01' all
+i=0
+while [ $i -lt 40 ]; do
+	touch src$i
+	i=$((i + 1))
+done
+
+# the command does not touch the target, so it is stale on every run
+expect_runs 1
+expect_runs 1 -j4
+expect_runs 1 -j4 --launchers
+expect_runs 1 --prefetch
+expect_runs 1 -B
+
+echo "$NAME: ok"
@@ -0,0 +1,73 @@
+/**
+ * Parse a makefile with one thread and with several, and check that both
+ * give the same graph.  Built with ThreadSanitizer, so that it also checks
+ * that the threads of a parallel parse do not race on the text.
+ *
+ * Usage: parse_threads MAKEFILE THREADS
+ *
+ * @file parse_threads.c
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "parser.h"
+
+/**
+ * Check that node i has the same name, prerequisites and command in a and b.
+ */
+static bool same_node(makefile *a, makefile *b, node_id i)
+{
+	if (strcmp(makefile_node_name(a, i), makefile_node_name(b, i)) != 0)
+		return false;
+
+	rule *ra = makefile_node_rule(a, i);
+	rule *rb = makefile_node_rule(b, i);
+	if (ra == NULL || rb == NULL)
+		return ra == rb;
+
+	const char **pa = rule_prereq(ra), **pb = rule_prereq(rb);
+	for (; *pa != NULL && *pb != NULL; pa++, pb++)
+		if (strcmp(*pa, *pb) != 0)
+			return false;
+	char **ca = rule_cmd(ra), **cb = rule_cmd(rb);
+	for (; *ca != NULL && *cb != NULL; ca++, cb++)
+		if (strcmp(*ca, *cb) != 0)
+			return false;
+	return *pa == *pb && *ca == *cb;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s MAKEFILE THREADS\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	parser_set_threads(1);
+	makefile *one = parse_makefile_path(argv[1]);
+	parser_set_threads(atoi(argv[2]));
+	makefile *many = parse_makefile_path(argv[1]);
+	if (one == NULL || many == NULL) {
+		fprintf(stderr, "%s: could not parse %s\n", argv[0], argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	size_t n = makefile_nodes(one);
+	if (makefile_nodes(many) != n) {
+		fprintf(stderr, "%s: %zu nodes with one thread, %zu with %s\n",
+				argv[0], n, makefile_nodes(many), argv[2]);
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (!same_node(one, many, i)) {
+			fprintf(stderr, "%s: node %s differs\n", argv[0],
+					makefile_node_name(one, i));
+			return EXIT_FAILURE;
+		}
+	}
+
+	makefile_del(one);
+	makefile_del(many);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,18 @@
+#!/bin/sh
+# A makefile parsed by several threads gives the same graph as when parsed by
+# one, and the threads do not race on the text.  The lines are short so that
+# the words at the end of one thread's part share vectors with the start of
+# the next.
+. "$(dirname "$0")/lib.sh"
+
+awk 'BEGIN {
+	for (i = 0; i < 20000; i++)
+		printf "t%d: p%d q%d\n\tc %d\n", i, i % 97, i % 89, i % 7
+}' > mmakefile
+
+for threads in 2 3 8 16; do
+	"$TESTS/parse_threads" mmakefile $threads \
+		|| fail "parse with $threads threads"
+done
+
+echo "$NAME: ok"
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Output written in pieces that each take a slot of their own in the pipe of
+# a captured command fills the pipe long before its size in bytes.  It is
+# collected as it comes, so the commands run to the end and all of their
+# output is printed.
+. "$(dirname "$0")/lib.sh"
+
+printf '@' > at
+printf 'all: a b\n\ttouch all\n\na: at\n\t%s at 2000\n\nb: at\n\t%s at 2000\n' \
+	"$TESTS/splice_out" "$TESTS/splice_out" > mmakefile
+
+for opt in "" --launchers; do
+	timeout 20 "$MMAKE" -B -j2 $opt > out
+	rc=$?
+	[ $rc -ne 124 ] || fail "mmake -B -j2 $opt was blocked on a full pipe"
+	[ $rc -eq 0 ] || fail "mmake -B -j2 $opt exited with $rc"
+	got=$(tr -cd @ < out | wc -c)
+	[ "$got" -eq 4000 ] || fail "mmake -B -j2 $opt printed $got bytes, not 4000"
+done
+
+echo "$NAME: ok"
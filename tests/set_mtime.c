@@ -0,0 +1,37 @@
+/**
+ * Set the modification time of files to the nanosecond, which touch cannot
+ * do portably, so that tests can create files whose times differ by less
+ * than a second.
+ *
+ * Usage: set_mtime SECONDS NANOSECONDS FILE...
+ *
+ * @file set_mtime.c
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+int main(int argc, char *argv[])
+{
+	if (argc < 4) {
+		fprintf(stderr, "usage: %s SECONDS NANOSECONDS FILE...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// the access time is left as it is
+	struct timespec times[2] = {
+		{ .tv_nsec = UTIME_OMIT },
+		{ .tv_sec = strtoll(argv[1], NULL, 10),
+		  .tv_nsec = strtol(argv[2], NULL, 10) },
+	};
+
+	for (int i = 3; i < argc; i++) {
+		if (utimensat(AT_FDCWD, argv[i], times, 0) < 0) {
+			perror(argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+/**
+ * Write the first byte of a file to standard output COUNT times, each with a
+ * splice() of its own.  Each byte then takes a buffer slot of its own in a
+ * pipe, so that a pipe is full long before it holds its size in bytes.
+ *
+ * Usage: splice_out FILE COUNT
+ *
+ * @file splice_out.c
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s FILE COUNT\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int fd = open(argv[1], O_RDONLY);
+	if (fd < 0) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	for (long i = atol(argv[2]); i > 0; i--) {
+		loff_t off = 0;
+		if (splice(fd, &off, STDOUT_FILENO, NULL, 1, 0) != 1) {
+			perror("splice");
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
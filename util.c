@@ -0,0 +1,61 @@
+/**
+ * Helpers shared by the cache and the build log.
+ *
+ * @file util.c
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "util.h"
+
+/**
+ * Create a temporary file next to path with the permissions of a new file.
+ *
+ * @param path  Path of the file to replace.
+ * @param tmp   Set to the allocated path of the temporary file.
+ * @return      File descriptor of the temporary file, or -1 on error.
+ */
+int temp_file_open(const char *path, char **tmp)
+{
+	*tmp = malloc(strlen(path) + sizeof ".XXXXXX");
+	if (*tmp == NULL)
+		return -1;
+	sprintf(*tmp, "%s.XXXXXX", path);
+
+	// mkstemp creates the file readable only by its owner
+	mode_t mask = umask(0);
+	umask(mask);
+
+	int fd = mkstemp(*tmp);
+	if (fd < 0) {
+		free(*tmp);
+		*tmp = NULL;
+		return -1;
+	}
+	fchmod(fd, 0666 & ~mask);
+
+	return fd;
+}
+
+/**
+ * Rename a temporary file to path if it was written, otherwise remove it.
+ *
+ * @param tmp   Path of the temporary file, which is freed.
+ * @param path  Path of the file to replace.
+ * @param ok    The temporary file was written and closed without errors.
+ * @return      0 if the file was replaced, -1 otherwise.
+ */
+int temp_file_finish(char *tmp, const char *path, bool ok)
+{
+	if (!ok || rename(tmp, path) < 0) {
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	free(tmp);
+	return 0;
+}
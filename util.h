@@ -0,0 +1,64 @@
+/**
+ * Helpers shared by the modules that keep files of their own: the cache of
+ * the parsed makefile, which is kept next to the makefile, and the build log,
+ * which is kept in the working directory.
+ *
+ * @file util.h
+ */
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Round n up to a multiple of 8 bytes */
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+/* Start value of a 64-bit FNV-1a hash */
+#define FNV_OFFSET 0xcbf29ce484222325
+
+/**
+ * Add n bytes at p to a 64-bit FNV-1a hash.  Kept inline since names are
+ * hashed for every word of a makefile.
+ *
+ * @param h     The hash so far, FNV_OFFSET to start a new hash.
+ * @param p     The bytes.
+ * @param n     Number of bytes.
+ * @return      The hash including the bytes.
+ */
+static inline uint64_t hash_fnv1a(uint64_t h, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+
+	for (size_t i = 0; i < n; i++) {
+		h ^= s[i];
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+/**
+ * Create a temporary file next to path, to be renamed to path once it has
+ * been written, so that the file at path is never seen half written.  The
+ * file gets the permissions a new file at path would get.
+ *
+ * @param path  Path of the file to replace.
+ * @param tmp   Set to the allocated path of the temporary file.
+ * @return      File descriptor of the temporary file, or -1 on error.
+ */
+int temp_file_open(const char *path, char **tmp);
+
+/**
+ * Replace the file at path with a temporary file from temp_file_open, or
+ * remove the temporary file if it could not be written.  The temporary file
+ * must have been closed.
+ *
+ * @param tmp   Path of the temporary file, which is freed.
+ * @param path  Path of the file to replace.
+ * @param ok    The temporary file was written and closed without errors.
+ * @return      0 if the file was replaced, -1 otherwise.
+ */
+int temp_file_finish(char *tmp, const char *path, bool ok);
+
+#endif